@@ -48,6 +48,10 @@
 #include "stm8s-005.h"
 #include "timer.h"
 #include "main.h"
+#include "uipopt.h"
+#include "uip.h"
+
+#include <string.h>
 
 // SPI Opcodes
 #define OPCODE_RCR			0x00	// Read Control Register
@@ -58,23 +62,57 @@
 #define OPCODE_BFC			0xA0	// Bit Field Clear
 #define OPCODE_SRC			0xFF	// System Reset Command (Soft Reset)
 
-// Banks
-#define BANK0				0
-#define BANK1				1
-#define BANK2				2
-#define BANK3				3
+// Number of bytes read from the start of a received frame to decide if
+// the rest of the frame is needed. This covers the Ethernet header plus
+// the IP header through the destination address, or the ARP packet
+// through the target IP address.
+#define RX_HEADER_BYTES			42
+#define RX_IP_DESTADDR			30	// Offset of IP destination address
+#define RX_STATUS_RXOK			0x80	// Receive status vector bit 23: Received Ok
+#define RX_MAXBYTECOUNT			1522	// Largest byte count of a valid frame incl. CRC
+#define RX_ARP_TARGETADDR		38	// Offset of ARP target IP address
+
+// Offsets into an outgoing TCP/IP frame used for checksum offload
+#define TX_IP_LEN			16	// IP total length
+#define TX_IP_PROTO			23	// IP protocol
+#define TX_IP_SRCADDR			26	// IP source address
+#define TX_IPH_LEN			20	// IP header length (uip never sends options)
+#define TX_TCP_CHKSUM			50	// TCP checksum
+#define TX_IP_DESTADDR			30	// IP destination address
+#define TX_TCP_OFFSET			46	// TCP data offset
+#define TX_TCP_FLAGS			47	// TCP flags
+#define TX_TCP_CTL			0x07	// TCP FIN, SYN and RST flags
+#define TX_TAG_LEN			16	// IP dest address to TCP ack number
 
 // Register Adresses
 // Bits 0-4 are the register adress (REGISTER_MASK)
+// Bits 5-6 are the bank the register is located in (REGISTER_BANKMASK).
+// The register access functions use this to select the bank, so callers
+// never switch banks themselves.
 // Bit 7 identifies whether the register is a MAC/MII register or
 // an ETH register because MAC and MII registers need a dummy byte
 // while reading them (REGISTER_NEEDDUMMY)
 #define REGISTER_MASK			0x1F
+#define REGISTER_BANKMASK		0x60
+#define REGISTER_BANKSHIFT		5
 #define REGISTER_NEEDDUMMY		0x80
 
+// Banks
+#define REGISTER_BANK0			0x00
+#define REGISTER_BANK1			0x20
+#define REGISTER_BANK2			0x40
+#define REGISTER_BANK3			0x60
+
+// Register adresses from this value up are available in every bank
+#define REGISTER_COMMON			0x1B
+
 // Registers in BankX: (means: available in each bank)
 #define BANKX_EIE			0x1B
+#define BANKX_EIE_PKTIE			6
+#define BANKX_EIE_INTIE			7
 #define BANKX_EIR			0x1C
+#define BANKX_EIR_RXERIF		0
+#define BANKX_EIR_PKTIF			6
 #define BANKX_ESTAT			0x1D
 #define BANKX_ESTAT_CLKRDY		0
 #define BANKX_ESTAT_TXABRT		1
@@ -98,63 +136,63 @@
 #define BANKX_ECON1_TXRST		7
 
 // Registers in Bank0:
-#define BANK0_ERDPTL			(0x00)
-#define BANK0_ERDPTH			(0x01)
-#define BANK0_EWRPTL			(0x02)
-#define BANK0_EWRPTH			(0x03)
-#define BANK0_ETXSTL			(0x04)
-#define BANK0_ETXSTH			(0x05)
-#define BANK0_ETXNDL			(0x06)
-#define BANK0_ETXNDH			(0x07)
-#define BANK0_ERXSTL			(0x08)
-#define BANK0_ERXSTH			(0x09)
-#define BANK0_ERXNDL			(0x0A)
-#define BANK0_ERXNDH			(0x0B)
-#define BANK0_ERXRDPTL			(0x0C)
-#define BANK0_ERXRDPTH			(0x0D)
-#define BANK0_ERXWRPTL			(0x0E)
-#define BANK0_ERXWRPTH			(0x0F)
-#define BANK0_EDMASTL			(0x10)
-#define BANK0_EDMASTH			(0x11)
-#define BANK0_EDMANDL			(0x12)
-#define BANK0_EDMANDH			(0x13)
-#define BANK0_EDMADSTL			(0x14)
-#define BANK0_EDMADSTH			(0x15)
-#define BANK0_EDMACSL			(0x16)
-#define BANK0_EDMACSH			(0x17)
+#define BANK0_ERDPTL			(0x00|REGISTER_BANK0)
+#define BANK0_ERDPTH			(0x01|REGISTER_BANK0)
+#define BANK0_EWRPTL			(0x02|REGISTER_BANK0)
+#define BANK0_EWRPTH			(0x03|REGISTER_BANK0)
+#define BANK0_ETXSTL			(0x04|REGISTER_BANK0)
+#define BANK0_ETXSTH			(0x05|REGISTER_BANK0)
+#define BANK0_ETXNDL			(0x06|REGISTER_BANK0)
+#define BANK0_ETXNDH			(0x07|REGISTER_BANK0)
+#define BANK0_ERXSTL			(0x08|REGISTER_BANK0)
+#define BANK0_ERXSTH			(0x09|REGISTER_BANK0)
+#define BANK0_ERXNDL			(0x0A|REGISTER_BANK0)
+#define BANK0_ERXNDH			(0x0B|REGISTER_BANK0)
+#define BANK0_ERXRDPTL			(0x0C|REGISTER_BANK0)
+#define BANK0_ERXRDPTH			(0x0D|REGISTER_BANK0)
+#define BANK0_ERXWRPTL			(0x0E|REGISTER_BANK0)
+#define BANK0_ERXWRPTH			(0x0F|REGISTER_BANK0)
+#define BANK0_EDMASTL			(0x10|REGISTER_BANK0)
+#define BANK0_EDMASTH			(0x11|REGISTER_BANK0)
+#define BANK0_EDMANDL			(0x12|REGISTER_BANK0)
+#define BANK0_EDMANDH			(0x13|REGISTER_BANK0)
+#define BANK0_EDMADSTL			(0x14|REGISTER_BANK0)
+#define BANK0_EDMADSTH			(0x15|REGISTER_BANK0)
+#define BANK0_EDMACSL			(0x16|REGISTER_BANK0)
+#define BANK0_EDMACSH			(0x17|REGISTER_BANK0)
 
 // Registers in Bank1:
-#define BANK1_EHT0			(0x00)
-#define BANK1_EHT1			(0x01)
-#define BANK1_EHT2			(0x02)
-#define BANK1_EHT3			(0x03)
-#define BANK1_EHT4			(0x04)
-#define BANK1_EHT5			(0x05)
-#define BANK1_EHT6			(0x06)
-#define BANK1_EHT7			(0x07)
-#define BANK1_EPMM0			(0x08)
-#define BANK1_EPMM1			(0x09)
-#define BANK1_EPMM2			(0x0A)
-#define BANK1_EPMM3			(0x0B)
-#define BANK1_EPMM4			(0x0C)
-#define BANK1_EPMM5			(0x0D)
-#define BANK1_EPMM6			(0x0E)
-#define BANK1_EPMM7			(0x0F)
-#define BANK1_EPMCSL			(0x10)
-#define BANK1_EPMCSH			(0x11)
-#define BANK1_EPMOL			(0x14)
-#define BANK1_EPMOH			(0x15)
-#define BANK1_ERXFCON			(0x18)
-#define BANK1_EPKTCNT			(0x19)
+#define BANK1_EHT0			(0x00|REGISTER_BANK1)
+#define BANK1_EHT1			(0x01|REGISTER_BANK1)
+#define BANK1_EHT2			(0x02|REGISTER_BANK1)
+#define BANK1_EHT3			(0x03|REGISTER_BANK1)
+#define BANK1_EHT4			(0x04|REGISTER_BANK1)
+#define BANK1_EHT5			(0x05|REGISTER_BANK1)
+#define BANK1_EHT6			(0x06|REGISTER_BANK1)
+#define BANK1_EHT7			(0x07|REGISTER_BANK1)
+#define BANK1_EPMM0			(0x08|REGISTER_BANK1)
+#define BANK1_EPMM1			(0x09|REGISTER_BANK1)
+#define BANK1_EPMM2			(0x0A|REGISTER_BANK1)
+#define BANK1_EPMM3			(0x0B|REGISTER_BANK1)
+#define BANK1_EPMM4			(0x0C|REGISTER_BANK1)
+#define BANK1_EPMM5			(0x0D|REGISTER_BANK1)
+#define BANK1_EPMM6			(0x0E|REGISTER_BANK1)
+#define BANK1_EPMM7			(0x0F|REGISTER_BANK1)
+#define BANK1_EPMCSL			(0x10|REGISTER_BANK1)
+#define BANK1_EPMCSH			(0x11|REGISTER_BANK1)
+#define BANK1_EPMOL			(0x14|REGISTER_BANK1)
+#define BANK1_EPMOH			(0x15|REGISTER_BANK1)
+#define BANK1_ERXFCON			(0x18|REGISTER_BANK1)
+#define BANK1_EPKTCNT			(0x19|REGISTER_BANK1)
 
 // Registers in Bank2:
-#define BANK2_MACON1			(0x00|REGISTER_NEEDDUMMY)
+#define BANK2_MACON1			(0x00|REGISTER_BANK2|REGISTER_NEEDDUMMY)
 #define BANK2_MACON1_MARXEN		0
 #define BANK2_MACON1_PASSALL		1
 #define BANK2_MACON1_RXPAUS		2
 #define BANK2_MACON1_TXPAUS		3
 
-#define BANK2_MACON3			(0x02|REGISTER_NEEDDUMMY)
+#define BANK2_MACON3			(0x02|REGISTER_BANK2|REGISTER_NEEDDUMMY)
 #define BANK2_MACON3_FULDPX		0
 #define BANK2_MACON3_FRMLNEN		1
 #define BANK2_MACON3_HFRMEN		2
@@ -164,46 +202,46 @@
 #define BANK2_MACON3_PADCFG1		6
 #define BANK2_MACON3_PADCFG2		7
 
-#define BANK2_MACON4			(0x03|REGISTER_NEEDDUMMY)
+#define BANK2_MACON4			(0x03|REGISTER_BANK2|REGISTER_NEEDDUMMY)
 #define BANK2_MACON4_NOBKOFF		4
 #define BANK2_MACON4_BPEN		5
 #define BANK2_MACON4_DEFER		6
-#define BANK2_MABBIPG			(0x04|REGISTER_NEEDDUMMY)
-#define BANK2_MAIPGL			(0x06|REGISTER_NEEDDUMMY)
-#define BANK2_MAIPGH			(0x07|REGISTER_NEEDDUMMY)
-#define BANK2_MACLCON1			(0x08|REGISTER_NEEDDUMMY)
-#define BANK2_MACLCON2			(0x09|REGISTER_NEEDDUMMY)
-#define BANK2_MAMXFLL			(0x0A|REGISTER_NEEDDUMMY)
-#define BANK2_MAMXFLH			(0x10|REGISTER_NEEDDUMMY)
-#define BANK2_MICMD			(0x12|REGISTER_NEEDDUMMY)
+#define BANK2_MABBIPG			(0x04|REGISTER_BANK2|REGISTER_NEEDDUMMY)
+#define BANK2_MAIPGL			(0x06|REGISTER_BANK2|REGISTER_NEEDDUMMY)
+#define BANK2_MAIPGH			(0x07|REGISTER_BANK2|REGISTER_NEEDDUMMY)
+#define BANK2_MACLCON1			(0x08|REGISTER_BANK2|REGISTER_NEEDDUMMY)
+#define BANK2_MACLCON2			(0x09|REGISTER_BANK2|REGISTER_NEEDDUMMY)
+#define BANK2_MAMXFLL			(0x0A|REGISTER_BANK2|REGISTER_NEEDDUMMY)
+#define BANK2_MAMXFLH			(0x0B|REGISTER_BANK2|REGISTER_NEEDDUMMY)
+#define BANK2_MICMD			(0x12|REGISTER_BANK2|REGISTER_NEEDDUMMY)
 #define BANK2_MICMD_MIIRD		0
 #define BANK2_MICMD_MIISCAN		1
-#define BANK2_MIREGADR			(0x14|REGISTER_NEEDDUMMY)
-#define BANK2_MIWRL			(0x16|REGISTER_NEEDDUMMY)
-#define BANK2_MIWRH			(0x17|REGISTER_NEEDDUMMY)
-#define BANK2_MIRDL			(0x18|REGISTER_NEEDDUMMY)
-#define BANK2_MIRDH			(0x19|REGISTER_NEEDDUMMY)
+#define BANK2_MIREGADR			(0x14|REGISTER_BANK2|REGISTER_NEEDDUMMY)
+#define BANK2_MIWRL			(0x16|REGISTER_BANK2|REGISTER_NEEDDUMMY)
+#define BANK2_MIWRH			(0x17|REGISTER_BANK2|REGISTER_NEEDDUMMY)
+#define BANK2_MIRDL			(0x18|REGISTER_BANK2|REGISTER_NEEDDUMMY)
+#define BANK2_MIRDH			(0x19|REGISTER_BANK2|REGISTER_NEEDDUMMY)
 
 // Registers in Bank3:
-#define BANK3_MAADR1			(0x00|REGISTER_NEEDDUMMY)
-#define BANK3_MAADR0			(0x01|REGISTER_NEEDDUMMY) // MAC LSB
-#define BANK3_MAADR3			(0x02|REGISTER_NEEDDUMMY)
-#define BANK3_MAADR2			(0x03|REGISTER_NEEDDUMMY)
-#define BANK3_MAADR5			(0x04|REGISTER_NEEDDUMMY) // MAC MSB
-#define BANK3_MAADR4			(0x05|REGISTER_NEEDDUMMY)
-#define BANK3_EBSTSD			(0x06)
-#define BANK3_EBSTCON			(0x07)
-#define BANK3_EBSTCSL			(0x08)
-#define BANK3_EBSTCSH			(0x09)
-#define BANK3_MISTAT			(0x0A|REGISTER_NEEDDUMMY)
+#define BANK3_MAADR1			(0x00|REGISTER_BANK3|REGISTER_NEEDDUMMY)
+#define BANK3_MAADR0			(0x01|REGISTER_BANK3|REGISTER_NEEDDUMMY) // MAC LSB
+#define BANK3_MAADR3			(0x02|REGISTER_BANK3|REGISTER_NEEDDUMMY)
+#define BANK3_MAADR2			(0x03|REGISTER_BANK3|REGISTER_NEEDDUMMY)
+#define BANK3_MAADR5			(0x04|REGISTER_BANK3|REGISTER_NEEDDUMMY) // MAC MSB
+#define BANK3_MAADR4			(0x05|REGISTER_BANK3|REGISTER_NEEDDUMMY)
+#define BANK3_EBSTSD			(0x06|REGISTER_BANK3)
+#define BANK3_EBSTCON			(0x07|REGISTER_BANK3)
+#define BANK3_EBSTCSL			(0x08|REGISTER_BANK3)
+#define BANK3_EBSTCSH			(0x09|REGISTER_BANK3)
+#define BANK3_MISTAT			(0x0A|REGISTER_BANK3|REGISTER_NEEDDUMMY)
 #define BANK3_MISTAT_BUSY		0
 #define BANK3_MISTAT_SCAN		1
 #define BANK3_MISTAT_NVALID		2
-#define BANK3_EREVID			(0x12)
-#define BANK3_ECOCON			(0x15)
-#define BANK3_EFLOCON			(0x17)
-#define BANK3_EPAUSL			(0x18)
-#define BANK3_EPAUSH			(0x19)
+#define BANK3_EREVID			(0x12|REGISTER_BANK3)
+#define BANK3_ECOCON			(0x15|REGISTER_BANK3)
+#define BANK3_EFLOCON			(0x17|REGISTER_BANK3)
+#define BANK3_EPAUSL			(0x18|REGISTER_BANK3)
+#define BANK3_EPAUSH			(0x19|REGISTER_BANK3)
 
 // PHY Registers
 #define PHY_PHCON1			0x00
@@ -237,8 +275,7 @@
 
 // Useful macros
 // #define NOP()			asm volatile ("nop")
-// #define SELECT()		do { PC_ODR &= (uint8_t)(~0x02); nop(); } while(0) // -CS low
-// #define DESELECT()		do { PC_ODR |= (uint8_t)0x02; nop(); } while(0) // -CS high
+// -CS is driven by SpiSelect() / SpiDeselect() in Spi.c
 
 // MAC address is defined in UIP modules
 extern uint8_t uip_ethaddr1;  // MAC MSB
@@ -247,21 +284,110 @@ extern uint8_t uip_ethaddr3;  //
 extern uint8_t uip_ethaddr4;  //
 extern uint8_t uip_ethaddr5;  //
 extern uint8_t uip_ethaddr6;  // MAC LSB
-
-
-void select(void)
+extern uint8_t enc28j60_config; // Duplex mode and buffer partition
+
+volatile uint8_t enc28j60_rx_pending; // Set when -INT signals a received packet
+
+// Buffer partition set by Enc28j60Init from enc28j60_config. The RX buffer
+// is ENC28J60_RXSTART to nRxEnd and the TX buffer is nTxStart to
+// ENC28J60_TXEND, holding nTxSlots TX slots.
+uint16_t nRxEnd;
+uint16_t nTxStart;
+uint8_t nTxSlots;
+
+#if PAGE_CACHE_SUPPORT == 1
+// Page cache. nCacheSize bytes from nCacheStart, between the RX and the
+// TX buffer. nCacheCopyLen bytes from nCacheCopyOffset are the end of the
+// payload of the next frame copied by Enc28j60CopyPacket (0 = none). The
+// first nCacheCopyHead bytes of the payload come from the frame buffer.
+uint16_t nCacheStart;
+uint16_t nCacheSize;
+uint16_t nCacheCopyOffset;
+uint16_t nCacheCopyLen;
+uint16_t nCacheCopyHead;
+#endif /* PAGE_CACHE_SUPPORT == 1 */
+
+// TX slot queue. nTxQueue holds the numbers of the queued slots in the
+// order they are to be sent. nTxQueue[nTxHead] is the oldest (the one being
+// transmitted when nTxActive is set) and nTxCount is the number queued.
+// nTxQueued has one bit set per queued slot. nTxSlot is the slot written by
+// the last Enc28j60CopyPacket and nTxNext is where the search for the next
+// free slot starts.
+uint16_t nTxSlotLen[ENC28J60_TXSLOTS];
+uint8_t nTxQueue[ENC28J60_TXSLOTS];
+uint8_t nTxHead;
+uint8_t nTxCount;
+uint8_t nTxQueued;
+uint8_t nTxSlot;
+uint8_t nTxNext;
+uint8_t nTxActive;
+
+#if ARP_PARK_SUPPORT == 1
+// TX slot holding the frame parked by Enc28j60Park (0xff = none). Its bit
+// in nTxQueued is set so the slot is neither reused nor queued again by
+// Enc28j60Rexmit until the frame is released or dropped.
+uint8_t nTxParked;
+#endif /* ARP_PARK_SUPPORT == 1 */
+
+#if UIP_TCP_WINDOW > 1
+// TX slots holding TCP segments that are kept until they are acknowledged
+// (one bit per slot). nTxPinNext is set by Enc28j60PinNext to pin the slot
+// of the next frame copied by Enc28j60CopyPacket.
+uint8_t nTxPinned;
+uint8_t nTxPinNext;
+#define TX_PINNED nTxPinned
+#else
+#define TX_PINNED 0
+#endif /* UIP_TCP_WINDOW > 1 */
+
+#if UIP_REXMIT_CACHE == 1
+// Retransmission cache. For a TX slot holding a TCP data segment Tag is a
+// copy of the frame from the IP destination address to the TCP ack number
+// (remote IP address, local port, remote port, seqno, ackno) and nLen is
+// the TCP data length. nLen == 0 means the slot holds no data segment.
+struct {
+  uint8_t Tag[TX_TAG_LEN];
+  uint16_t nLen;
+} TxCache[ENC28J60_TXSLOTS];
+#endif /* UIP_REXMIT_CACHE == 1 */
+
+
+uint8_t nCurrentBank; // Shadow of the ECON1 BSEL bits
+
+
+// Selects the bank the given register is located in
+// The currently selected bank is shadowed in nCurrentBank, so ECON1 is
+// only touched when the bank actually changes, and then only the BSEL
+// bits that differ are set or cleared. Registers available in every bank
+// never cause a switch.
+// ENC28J60_INLINE
+void Enc28j60SwitchBank(uint8_t nRegister)
 {
-  // -CS low
-  PC_ODR &= (uint8_t)(~0x02);
-  nop();
-}
+  uint8_t nBank;
+  uint8_t nBits;
 
+  if ((nRegister & REGISTER_MASK) >= REGISTER_COMMON) return;
+  nBank = (uint8_t)((nRegister & REGISTER_BANKMASK) >> REGISTER_BANKSHIFT);
+  if (nBank == nCurrentBank) return;
 
-void deselect(void)
-{
-  // -CS high
-  PC_ODR |= (uint8_t)0x02;
-  nop();
+  // Use built-in Bit-Set/Bit-Clear functions only while switching bank!
+  // This is important since a read-modify-write cycle could alter unwanted
+  // bits that got set or reset between read and write
+  nBits = (uint8_t)(nCurrentBank & ~nBank);
+  if (nBits) {
+    SpiSelect();
+    SpiWriteByte((uint8_t)(OPCODE_BFC | BANKX_ECON1));
+    SpiWriteByte((uint8_t)(nBits << BANKX_ECON1_BSEL0));
+    SpiDeselect();
+  }
+  nBits = (uint8_t)(nBank & ~nCurrentBank);
+  if (nBits) {
+    SpiSelect();
+    SpiWriteByte((uint8_t)(OPCODE_BFS | BANKX_ECON1));
+    SpiWriteByte((uint8_t)(nBits << BANKX_ECON1_BSEL0));
+    SpiDeselect();
+  }
+  nCurrentBank = nBank;
 }
 
 
@@ -271,13 +397,15 @@ uint8_t Enc28j60ReadReg(uint8_t nRegister)
 {
   uint8_t nByte;
 
-  select();
+  Enc28j60SwitchBank(nRegister);
+
+  SpiSelect();
 	
   SpiWriteByte((uint8_t)(OPCODE_RCR | (nRegister & REGISTER_MASK)));
   if (nRegister & REGISTER_NEEDDUMMY) SpiWriteByte(0);
   nByte = SpiReadByte();
 
-  deselect();
+  SpiDeselect();
 
   return nByte;
 }
@@ -287,12 +415,36 @@ uint8_t Enc28j60ReadReg(uint8_t nRegister)
 // ENC28J60_INLINE
 void Enc28j60WriteReg( uint8_t nRegister, uint8_t nData)
 {
-  select();
+  Enc28j60SwitchBank(nRegister);
+
+  SpiSelect();
 
   SpiWriteByte((uint8_t)(OPCODE_WCR | (nRegister & REGISTER_MASK)));
   SpiWriteByte(nData);
 
-  deselect();
+  SpiDeselect();
+}
+
+
+// Writes a 16 bit value to an Enc28j60 register pair
+// nRegister is the low byte register (ERDPTL, ERXRDPTL, EWRPTL, ETXNDL,
+// etc). The high byte register is always the next adress in the same
+// bank. The bank is selected once for both writes, and the low byte is
+// written first as required for ERXRDPT.
+// ENC28J60_INLINE
+void Enc28j60WriteReg16(uint8_t nRegister, uint16_t nData)
+{
+  Enc28j60SwitchBank(nRegister);
+
+  SpiSelect();
+  SpiWriteByte((uint8_t)(OPCODE_WCR | (nRegister & REGISTER_MASK)));
+  SpiWriteByte((uint8_t)(nData >> 0));
+  SpiDeselect();
+
+  SpiSelect();
+  SpiWriteByte((uint8_t)(OPCODE_WCR | ((nRegister + 1) & REGISTER_MASK)));
+  SpiWriteByte((uint8_t)(nData >> 8));
+  SpiDeselect();
 }
 
 
@@ -300,12 +452,14 @@ void Enc28j60WriteReg( uint8_t nRegister, uint8_t nData)
 // ENC28J60_INLINE
 void Enc28j60SetMaskReg(uint8_t nRegister, uint8_t nMask)
 {
-  select();
+  Enc28j60SwitchBank(nRegister);
+
+  SpiSelect();
 
   SpiWriteByte((uint8_t)(OPCODE_BFS | (nRegister & REGISTER_MASK)));
   SpiWriteByte(nMask);
 
-  deselect();
+  SpiDeselect();
 }
 
 
@@ -313,24 +467,14 @@ void Enc28j60SetMaskReg(uint8_t nRegister, uint8_t nMask)
 // ENC28J60_INLINE
 void Enc28j60ClearMaskReg( uint8_t nRegister, uint8_t nMask)
 {
-  select();
+  Enc28j60SwitchBank(nRegister);
+
+  SpiSelect();
 
   SpiWriteByte((uint8_t)(OPCODE_BFC | (nRegister & REGISTER_MASK)));
   SpiWriteByte(nMask);
 
-  deselect();
-}
-
-
-// Switches the currently selected bank
-// ENC28J60_INLINE
-void Enc28j60SwitchBank(uint8_t nBank)
-{
-  // Use built-in Bit-Set/Bit-Clear functions only while switching bank!
-  // This is important since a read-modify-write cycle could alter unwanted
-  // bits that got set or reset between read and write
-  Enc28j60ClearMaskReg(BANKX_ECON1, (3<<BANKX_ECON1_BSEL0));
-  Enc28j60SetMaskReg(BANKX_ECON1, (uint8_t)(nBank << BANKX_ECON1_BSEL0));
+  SpiDeselect();
 }
 
 
@@ -339,12 +483,9 @@ void Enc28j60SwitchBank(uint8_t nBank)
 // ENC28J60_INLINE
 uint16_t Enc28j60ReadPhy(uint8_t nRegister)
 {
-  Enc28j60SwitchBank(BANK2);
   Enc28j60WriteReg(BANK2_MIREGADR, nRegister);
   Enc28j60SetMaskReg(BANK2_MICMD, (1<<BANK2_MICMD_MIIRD));
-  Enc28j60SwitchBank(BANK3);
   while (Enc28j60ReadReg(BANK3_MISTAT) & (1 <<BANK3_MISTAT_BUSY)) nop();
-  Enc28j60SwitchBank(BANK2);
   Enc28j60ClearMaskReg(BANK2_MICMD, (1<<BANK2_MICMD_MIIRD));
 
   return ((uint16_t) Enc28j60ReadReg(BANK2_MIRDL) << 0)
@@ -357,21 +498,72 @@ uint16_t Enc28j60ReadPhy(uint8_t nRegister)
 // ENC28J60_INLINE
 void Enc28j60WritePhy( uint8_t nRegister, uint16_t nData)
 {
-  Enc28j60SwitchBank(BANK2);
   Enc28j60WriteReg(BANK2_MIREGADR, nRegister);
-  Enc28j60WriteReg(BANK2_MIWRL, (uint8_t)(nData >> 0));
-  Enc28j60WriteReg(BANK2_MIWRH, (uint8_t)(nData >> 8));
-  Enc28j60SwitchBank(BANK3);
+  Enc28j60WriteReg16(BANK2_MIWRL, nData);
   while (Enc28j60ReadReg(BANK3_MISTAT) & (1 <<BANK3_MISTAT_BUSY)) nop();
 }
 
 
+#if RX_FILTER_SUPPORT == 1
+// Programs the pattern match filter to accept broadcast ARP requests for
+// our IP address.
+// The filter looks at a 64 byte window starting at EPMO. Each bit of
+// EPMM0-7 selects one byte of the window. The selected bytes are run
+// through the IP checksum algorithm and the frame matches if the result
+// equals EPMCS. The selected bytes are:
+//   0-5   Destination MAC FF-FF-FF-FF-FF-FF
+//   12-13 EtherType 0x0806 (ARP)
+//   20-21 ARP opcode 0x0001 (request)
+//   38-41 ARP target IP address (our IP address)
+void Enc28j60SetArpPattern(void)
+{
+  uint8_t* pHostAddr;
+  uint32_t nSum;
+
+  pHostAddr = (uint8_t*)uip_hostaddr;
+
+  Enc28j60WriteReg16(BANK1_EPMOL, 0);
+  Enc28j60WriteReg(BANK1_EPMM0, 0x3f);  // Bytes 0-5
+  Enc28j60WriteReg(BANK1_EPMM1, 0x30);  // Bytes 12-13
+  Enc28j60WriteReg(BANK1_EPMM2, 0x30);  // Bytes 20-21
+  Enc28j60WriteReg(BANK1_EPMM3, 0x00);
+  Enc28j60WriteReg(BANK1_EPMM4, 0xc0);  // Bytes 38-39
+  Enc28j60WriteReg(BANK1_EPMM5, 0x03);  // Bytes 40-41
+  Enc28j60WriteReg(BANK1_EPMM6, 0x00);
+  Enc28j60WriteReg(BANK1_EPMM7, 0x00);
+
+  nSum = 0xffff + 0xffff + 0xffff + 0x0806 + 0x0001;
+  nSum += ((uint16_t)pHostAddr[0] << 8) | pHostAddr[1];
+  nSum += ((uint16_t)pHostAddr[2] << 8) | pHostAddr[3];
+  while (nSum >> 16) nSum = (nSum & 0xffff) + (nSum >> 16);
+  Enc28j60WriteReg16(BANK1_EPMCSL, (uint16_t)(~nSum));
+}
+#endif /* RX_FILTER_SUPPORT == 1 */
+
+
+uint8_t Enc28j60CheckConfig(uint8_t nConfig)
+{
+  uint8_t nSlots;
+
+  nSlots = (uint8_t)(nConfig & ENC28J60_CFG_TXSLOTS);
+  if (nSlots == 0 || nSlots > ENC28J60_TXSLOTS
+   || (nConfig & (uint8_t)~(ENC28J60_CFG_TXSLOTS|ENC28J60_CFG_FULDPX))) {
+#if ENC28J60_FULL_DUPLEX == 1
+    nConfig = ENC28J60_TX_PARTITION | ENC28J60_CFG_FULDPX;
+#else
+    nConfig = ENC28J60_TX_PARTITION;
+#endif /* ENC28J60_FULL_DUPLEX == 1 */
+  }
+  return nConfig;
+}
+
+
 void Enc28j60Init(void)
 {
   // It is assumed that the gpio_init set up the pins used for SPI bit
   // bang and that the spi_init released the Reset- pin.
 
-  deselect(); // Just makes sure the -CS is not selected
+  SpiDeselect(); // Just makes sure the -CS is not selected
 
   // Wait for the Oscillation Startup Timer. From the spec sheet:
   // The ENC28J60 contains an Oscillator Start-up Timer (OST) to ensure that
@@ -388,38 +580,61 @@ void Enc28j60Init(void)
   while (!(Enc28j60ReadReg(BANKX_ESTAT) & (1<<BANKX_ESTAT_CLKRDY))) nop();
 
   // Reset ENC28J60 system
-  select();
+  SpiSelect();
   SpiWriteByte(OPCODE_SRC); // Reset command
-  deselect();
+  SpiDeselect();
   wait_timer((uint16_t)10000); // delay 10 ms
+  nCurrentBank = 0; // The reset clears ECON1, selecting bank 0
 
   // Reset ENC28J60 PHY
   Enc28j60WritePhy(PHY_PHCON1, (uint16_t)(1<<PHY_PHCON1_PRST)); // Reset command
   // Wait for PHY reset completion
   while (Enc28j60ReadPhy(PHY_PHCON1) & (uint16_t)(1<<PHY_PHCON1_PRST)) nop();
 
-  // Do bank 0 initializations
-  Enc28j60SwitchBank(BANK0);
+  // Split the buffer memory between RX and TX
+  enc28j60_config = Enc28j60CheckConfig(enc28j60_config);
+  nTxSlots = (uint8_t)(enc28j60_config & ENC28J60_CFG_TXSLOTS);
+  nTxStart = (uint16_t)(ENC28J60_TXEND + 1 - (nTxSlots * ENC28J60_TXSLOTSIZE));
+#if PAGE_CACHE_SUPPORT == 1
+  // The page cache sits below the TX buffer if it leaves at least 1KB RX
+  nCacheSize = (uint16_t)(PAGE_CACHE_SIZE * 1024);
+  if (nTxStart - ENC28J60_RXSTART < nCacheSize + 1024) nCacheSize = 0;
+  nCacheStart = nTxStart - nCacheSize;
+  nCacheCopyLen = 0;
+  nRxEnd = nCacheStart - 1;
+#else
+  nRxEnd = nTxStart - 1;
+#endif /* PAGE_CACHE_SUPPORT == 1 */
 
+  // Do bank 0 initializations
   // Initialize Receive Buffer
-  Enc28j60WriteReg(BANK0_ERXSTL, (uint8_t) (ENC28J60_RXSTART >> 0));
-  Enc28j60WriteReg(BANK0_ERXSTH, (uint8_t) (ENC28J60_RXSTART >> 8));
-  Enc28j60WriteReg(BANK0_ERXNDL, (uint8_t) (ENC28J60_RXEND >> 0));
-  Enc28j60WriteReg(BANK0_ERXNDH, (uint8_t) (ENC28J60_RXEND >> 8));
+  Enc28j60WriteReg16(BANK0_ERXSTL, ENC28J60_RXSTART);
+  Enc28j60WriteReg16(BANK0_ERXNDL, nRxEnd);
   // Receiver Pointer
-  Enc28j60WriteReg(BANK0_ERDPTL, (uint8_t) (ENC28J60_RXSTART >> 0));
-  Enc28j60WriteReg(BANK0_ERDPTH, (uint8_t) (ENC28J60_RXSTART >> 8));
+  Enc28j60WriteReg16(BANK0_ERDPTL, ENC28J60_RXSTART);
   // Errata Workaround: ERXRDPT should not be programmed with an even address
   // so we choose RXSTART-1 which is equal to RXEND 
-  Enc28j60WriteReg(BANK0_ERXRDPTL, (uint8_t) (ENC28J60_RXEND >> 0));
-  Enc28j60WriteReg(BANK0_ERXRDPTH, (uint8_t) (ENC28J60_RXEND >> 8));
+  Enc28j60WriteReg16(BANK0_ERXRDPTL, nRxEnd);
   // and Transmit Pointer
-  Enc28j60WriteReg(BANK0_ETXSTL, (uint8_t) (ENC28J60_TXSTART >> 0));
-  Enc28j60WriteReg(BANK0_ETXSTH, (uint8_t) (ENC28J60_TXSTART >> 8));
+  Enc28j60WriteReg16(BANK0_ETXSTL, nTxStart);
+  // The reset above aborted any transmission, so empty the TX slot queue
+  nTxHead = 0;
+  nTxCount = 0;
+  nTxQueued = 0;
+  nTxNext = 0;
+  nTxActive = 0;
+#if ARP_PARK_SUPPORT == 1
+  nTxParked = 0xff;
+#endif /* ARP_PARK_SUPPORT == 1 */
+#if UIP_TCP_WINDOW > 1
+  nTxPinned = 0;
+  nTxPinNext = 0;
+#endif /* UIP_TCP_WINDOW > 1 */
+#if UIP_REXMIT_CACHE == 1
+  memset(TxCache, 0, sizeof(TxCache));
+#endif /* UIP_REXMIT_CACHE == 1 */
 
   // Bank 1 initializations
-  Enc28j60SwitchBank(BANK1);
-
   // Packet Filter
   // From the spec:
   // Filter default = 0xa1 0b10100001
@@ -465,9 +680,18 @@ void Enc28j60Init(void)
   //           FF-FF-FF-FF-FF-FF will be accepted
   //       0 = Filter disabled
   //
+#if RX_FILTER_SUPPORT == 0
   Enc28j60WriteReg(BANK1_ERXFCON, (uint8_t)0xa1);    // Allows packets if MAC matches
 						     // CRC check ON
 						     // FF-FF Packets accepted
+#endif /* RX_FILTER_SUPPORT == 0 */
+#if RX_FILTER_SUPPORT == 1
+  Enc28j60SetArpPattern();
+  Enc28j60WriteReg(BANK1_ERXFCON, (uint8_t)0xb0);    // Allows packets if MAC matches
+						     // CRC check ON
+						     // Pattern match ON (ARP for our IP)
+						     // Other FF-FF Packets rejected
+#endif /* RX_FILTER_SUPPORT == 1 */
   // Enc28j60WriteReg(BANK1_ERXFCON, (uint8_t)0xa0);   // Allows packets if MAC matches
 						     // CRC check ON
 						     // FF-FF Packets rejected
@@ -482,8 +706,6 @@ void Enc28j60Init(void)
 						     // FF-FF Packets rejected
 
   // Bank 2 initializations
-  Enc28j60SwitchBank(BANK2);
-
   // MAC RX Enable
   Enc28j60WriteReg(BANK2_MACON1, (1<<BANK2_MACON1_MARXEN));
 
@@ -501,10 +723,16 @@ void Enc28j60Init(void)
   // HFRMEN = 0 = Frames bigger than MAMXFL will be aborted when transmitted or
   //   received
   // FULDPX = 0 = MAC will operate in half-duplex. PHCON1.PDPXMD must also be clear.
-  Enc28j60SetMaskReg(BANK2_MACON3, (1<<BANK2_MACON3_TXCRCEN)|(1<<BANK2_MACON3_PADCFG0)|(1<<BANK2_MACON3_FRMLNEN));
+  // FULDPX = 1 = MAC will operate in full-duplex. PHCON1.PDPXMD must also be set.
+  if (enc28j60_config & ENC28J60_CFG_FULDPX) {
+    Enc28j60SetMaskReg(BANK2_MACON3, (1<<BANK2_MACON3_TXCRCEN)|(1<<BANK2_MACON3_PADCFG0)|(1<<BANK2_MACON3_FRMLNEN)|(1<<BANK2_MACON3_FULDPX));
+  }
+  else {
+    Enc28j60SetMaskReg(BANK2_MACON3, (1<<BANK2_MACON3_TXCRCEN)|(1<<BANK2_MACON3_PADCFG0)|(1<<BANK2_MACON3_FRMLNEN));
 
-  // "For IEEE802.3 compliance"
-  Enc28j60SetMaskReg(BANK2_MACON4, (1<<BANK2_MACON4_DEFER));
+    // "For IEEE802.3 compliance" (half-duplex only)
+    Enc28j60SetMaskReg(BANK2_MACON4, (1<<BANK2_MACON4_DEFER));
+  }
 
   // Set the maximum frame-length to prevent host-controller from buffer overflows
   // frame-length + CRC (CRC will not occupy any host buffer-space)
@@ -514,15 +742,15 @@ void Enc28j60Init(void)
   // Non-back to back-Inter-Packet-Delay-Gap. (datasheet recommendation)
   Enc28j60WriteReg(BANK2_MAIPGL, 0x12);
 
-  // Datasheet recommendation
+  // Datasheet recommendation (only used in half-duplex)
   Enc28j60WriteReg(BANK2_MAIPGH, 0x0C);
 
   // Back to back-Inter-Packet-Delay-Gap. (datasheet recommendation)
-  Enc28j60WriteReg(BANK2_MABBIPG, 0x12);
+  // 0x15 for full-duplex, 0x12 for half-duplex
+  if (enc28j60_config & ENC28J60_CFG_FULDPX) Enc28j60WriteReg(BANK2_MABBIPG, 0x15);
+  else Enc28j60WriteReg(BANK2_MABBIPG, 0x12);
 
   // Bank 3 initializations
-  Enc28j60SwitchBank(BANK3);
-
   // Initialize MAC-adress
   Enc28j60WriteReg(BANK3_MAADR5, uip_ethaddr1);  // MAC MSB
   Enc28j60WriteReg(BANK3_MAADR4, uip_ethaddr2);
@@ -542,24 +770,118 @@ void Enc28j60Init(void)
     (1<<PHY_PHLCON_STRCH)|0x3000);
 
   // Errata Workaround: Because the LED-Polarity detection circuit does not function properly,
-  // we clear the FullDuplex Bit ourself. MACON3.FULDPX is cleared anyway.
-  Enc28j60WritePhy(PHY_PHCON1, 0x0000);
+  // we set the PHY duplex mode ourself to match MACON3.FULDPX.
+  if (enc28j60_config & ENC28J60_CFG_FULDPX) {
+    Enc28j60WritePhy(PHY_PHCON1, (uint16_t)(1<<PHY_PHCON1_PDPXMD));
+  }
+  else Enc28j60WritePhy(PHY_PHCON1, 0x0000);
+
+#if RX_INTERRUPT_SUPPORT == 1
+  // Enable the -INT output for the Receive Packet Pending interrupt only.
+  // -INT is held low for as long as EPKTCNT is non-zero.
+  Enc28j60WriteReg(BANKX_EIE, (1<<BANKX_EIE_INTIE)|(1<<BANKX_EIE_PKTIE));
+  // Check the receive buffer on the first pass of the main loop
+  enc28j60_rx_pending = 1;
+#endif /* RX_INTERRUPT_SUPPORT == 1 */
 
   // Enable Packet Reception
   Enc28j60SetMaskReg(BANKX_ECON1, (1<<BANKX_ECON1_RXEN));
 }
 
 
+@far @interrupt void Enc28j60Interrupt(void)
+{
+  // Port C external interrupt (EXTI2). PC5 (ENC28J60 -INT) is the only
+  // Port C pin with its interrupt enabled, and it is set up for falling
+  // edge only. All the handler does is flag the main loop; the SPI
+  // traffic to collect the packet happens in Enc28j60Receive().
+  enc28j60_rx_pending = 1;
+}
+
+
+// Decides from the first RX_HEADER_BYTES of a received frame whether the
+// frame is of any use to the application. Only ARP packets targeting our
+// IP address and IP packets sent to our IP address are kept. Everything
+// else (other hosts' ARP traffic, IP broadcasts and multicasts, non-IP
+// protocols) would be dropped by uip anyway.
+static uint8_t Enc28j60FrameWanted(uint8_t* pFrame)
+{
+  uint8_t* pAddr;
+  uint8_t* pHostAddr;
+
+  if (pFrame[12] != 0x08) return 0;
+  if (pFrame[13] == 0x00) pAddr = &pFrame[RX_IP_DESTADDR];          // IPv4
+  else if (pFrame[13] == 0x06) pAddr = &pFrame[RX_ARP_TARGETADDR];  // ARP
+  else return 0;
+
+  pHostAddr = (uint8_t*)uip_hostaddr;
+  if (pAddr[0] != pHostAddr[0]) return 0;
+  if (pAddr[1] != pHostAddr[1]) return 0;
+  if (pAddr[2] != pHostAddr[2]) return 0;
+  if (pAddr[3] != pHostAddr[3]) return 0;
+  return 1;
+}
+
+
+static void Enc28j60RxReset(void)
+{
+  // Resets only the receive side of the ENC28J60 and empties the RX buffer.
+  // Transmission and all other settings are left untouched, so this takes
+  // a few dozen SPI transfers instead of a full Enc28j60Init().
+  uint8_t i;
+
+  Enc28j60ClearMaskReg(BANKX_ECON1, (1<<BANKX_ECON1_RXEN));
+  Enc28j60SetMaskReg(BANKX_ECON1, (1<<BANKX_ECON1_RXRST));
+  Enc28j60ClearMaskReg(BANKX_ECON1, (1<<BANKX_ECON1_RXRST));
+
+  // Writing ERXST also moves the hardware write pointer ERXWRPT to the
+  // start of the buffer
+  Enc28j60WriteReg16(BANK0_ERXSTL, ENC28J60_RXSTART);
+  Enc28j60WriteReg16(BANK0_ERXNDL, nRxEnd);
+  Enc28j60WriteReg16(BANK0_ERDPTL, ENC28J60_RXSTART);
+  Enc28j60WriteReg16(BANK0_ERXRDPTL, nRxEnd);
+
+  // The frames still counted in EPKTCNT are gone, count them down
+  i = 255;
+  while (Enc28j60ReadReg(BANK1_EPKTCNT) != 0 && i-- != 0) {
+    Enc28j60SetMaskReg(BANKX_ECON2, (1<<BANKX_ECON2_PKTDEC));
+  }
+  Enc28j60ClearMaskReg(BANKX_EIR, (1<<BANKX_EIR_RXERIF));
+
+  Enc28j60SetMaskReg(BANKX_ECON1, (1<<BANKX_ECON1_RXEN));
+
+#if UIP_STATISTICS == 1
+  uip_stat.eth.rxreset++;
+#endif /* UIP_STATISTICS == 1 */
+}
+
+
 uint16_t Enc28j60Receive(uint8_t* pBuffer)
 {
   uint16_t nBytes;
   uint16_t nNextPacket;
+  uint8_t nStatus;
+
+#if RX_INTERRUPT_SUPPORT == 1
+  // Don't touch the ENC28J60 unless -INT has signaled a packet
+  if (enc28j60_rx_pending == 0) return 0;
+  enc28j60_rx_pending = 0;
+#endif /* RX_INTERRUPT_SUPPORT == 1 */
+
+  // RXERIF is set when a frame was lost because the RX buffer was full or
+  // EPKTCNT reached 255. The frames already in the buffer are still valid,
+  // so just count the event and let the loop below drain the buffer.
+  if (Enc28j60ReadReg(BANKX_EIR) & (1<<BANKX_EIR_RXERIF)) {
+    Enc28j60ClearMaskReg(BANKX_EIR, (1<<BANKX_EIR_RXERIF));
+#if UIP_STATISTICS == 1
+    uip_stat.eth.overflow++;
+#endif /* UIP_STATISTICS == 1 */
+  }
 
   // Check for at least 1 waiting packet in the buffer
-  Enc28j60SwitchBank(BANK1);
   if (Enc28j60ReadReg(BANK1_EPKTCNT) == 0) return 0;
 
-  select();
+  SpiSelect();
 
   SpiWriteByte(OPCODE_RBM);
 
@@ -567,15 +889,26 @@ uint16_t Enc28j60Receive(uint8_t* pBuffer)
   nNextPacket = ((uint16_t) SpiReadByte() << 0);
   nNextPacket |= ((uint16_t) SpiReadByte() << 8);
 
-  // Read Received Bytecount (minus 4 to remove CRC)
+  // Read Received Bytecount (includes the 4 byte CRC)
   nBytes = ((uint16_t) SpiReadByte() << 0);
   nBytes |= ((uint16_t) SpiReadByte() << 8);
-  nBytes -= 4;
 
-  // 2 Bytes Status bits (unused)
-  SpiReadByte();
+  // 2 Bytes Status bits. Only bit 23 "Received Ok" is used.
+  nStatus = SpiReadByte();
   SpiReadByte();
 
+  // A next packet pointer outside the RX buffer or an impossible byte
+  // count means the receive header is corrupt (or was read from the wrong
+  // place). There is no way to find the next frame, so reset the receive
+  // logic and start over with an empty buffer.
+  if (nNextPacket > nRxEnd || (nNextPacket & 1)
+   || nBytes < 4 || nBytes > RX_MAXBYTECOUNT) {
+    SpiDeselect();
+    Enc28j60RxReset();
+    return 0;
+  }
+  nBytes -= 4;
+
   // Frame-Data
   //   Comment: This seems broken to me ... maybe I'm missing something. But if we
   //   receive a packet larger than MAXFRAME we don't read it???  I found this
@@ -597,14 +930,46 @@ uint16_t Enc28j60Receive(uint8_t* pBuffer)
   //   to run the test on a direct PC to device connection to eliminate extraneous
   //   traffic.
   //
-  if (nBytes <= ENC28J60_MAXFRAME) SpiReadChunk(pBuffer, nBytes);
+  //   Only the header is read first. If Enc28j60FrameWanted() rejects the
+  //   frame the payload is never transferred over SPI; the read pointers
+  //   below simply skip over it.
+  //
+  //   Frames larger than ENC28J60_MAXFRAME and frames the ENC28J60 did not
+  //   receive correctly are skipped without being read and return zero,
+  //   so uip never parses stale uip_buf contents.
+  //
+  if (!(nStatus & RX_STATUS_RXOK)) {
+    nBytes = 0;
+#if UIP_STATISTICS == 1
+    uip_stat.eth.rxerror++;
+#endif /* UIP_STATISTICS == 1 */
+  }
+  else if (nBytes > ENC28J60_MAXFRAME) {
+    nBytes = 0;
+#if UIP_STATISTICS == 1
+    uip_stat.eth.oversize++;
+#endif /* UIP_STATISTICS == 1 */
+  }
+  else {
+    if (nBytes >= RX_HEADER_BYTES) {
+      SpiReadChunk(pBuffer, RX_HEADER_BYTES);
+      if (Enc28j60FrameWanted(pBuffer)) {
+        SpiReadChunk(pBuffer + RX_HEADER_BYTES, (uint16_t)(nBytes - RX_HEADER_BYTES));
+      }
+      else {
+        nBytes = 0;
+#if UIP_STATISTICS == 1
+        uip_stat.eth.skipped++;
+#endif /* UIP_STATISTICS == 1 */
+      }
+    }
+    else SpiReadChunk(pBuffer, nBytes);
+  }
 
-  deselect();
+  SpiDeselect();
 
-  Enc28j60SwitchBank(BANK0);
   // Set RX Read-Pointer and SPI Read-Pointer to next-frame-address
-  Enc28j60WriteReg(BANK0_ERDPTL , (uint8_t) (nNextPacket >> 0));
-  Enc28j60WriteReg(BANK0_ERDPTH , (uint8_t) (nNextPacket >> 8));
+  Enc28j60WriteReg16(BANK0_ERDPTL, nNextPacket);
 
   // Errata Workaround: ERXRDPT should never be programmed with an even value
   // Because the NextPacket will always point to an even value, we can subtract 1 from it
@@ -612,40 +977,170 @@ uint16_t Enc28j60Receive(uint8_t* pBuffer)
   if (nNextPacket == ( ((uint16_t)ENC28J60_RXSTART) - 1 )) {
     // Underflow occured while subtracting 1? Use RXEND then. The ENC28J60 logic will
     // set the pointer to the next even address, which is RXSTART.
-    nNextPacket = ENC28J60_RXEND;
+    nNextPacket = nRxEnd;
   }
 
-  Enc28j60WriteReg(BANK0_ERXRDPTL, (uint8_t)(nNextPacket >> 0));
-  Enc28j60WriteReg(BANK0_ERXRDPTH, (uint8_t)(nNextPacket >> 8));
+  Enc28j60WriteReg16(BANK0_ERXRDPTL, nNextPacket);
 
   // And decrement PacketCounter
   Enc28j60SetMaskReg(BANKX_ECON2 , (1<<BANKX_ECON2_PKTDEC));
 
+#if RX_INTERRUPT_SUPPORT == 1
+  // If more packets are waiting -INT is still low and there will be no
+  // new falling edge for them, so come back on the next pass.
+  if (!(PC_IDR & (uint8_t)0x20)) enc28j60_rx_pending = 1;
+#endif /* RX_INTERRUPT_SUPPORT == 1 */
+
   return nBytes;
 }
 
 
+// Starts transmission of the frame in the given TX slot
+void Enc28j60TxStart(uint8_t nSlot)
+{
+  uint16_t TxStart = nTxStart + (nSlot * ENC28J60_TXSLOTSIZE);
+
+  Enc28j60WriteReg16(BANK0_ETXSTL, TxStart);
+  Enc28j60WriteReg16(BANK0_ETXNDL, TxStart + nTxSlotLen[nSlot]);
+
+  // Errata Workaround: Reset TX Logic
+  Enc28j60SetMaskReg(BANKX_ECON1, (1<<BANKX_ECON1_TXRST));
+  Enc28j60ClearMaskReg(BANKX_ECON1, (1<<BANKX_ECON1_TXRST));
+
+  // Start transmission
+  Enc28j60SetMaskReg(BANKX_ECON1, (1<<BANKX_ECON1_TXRTS));
+  nTxActive = 1;
+}
+
+
+void Enc28j60TxPoll(void)
+{
+  // Retire the frame on the wire once the ENC28J60 clears TXRTS, then
+  // start the next queued frame (if any). ECON1 is only read while a
+  // transmission is in progress.
+  if (nTxActive) {
+    if (Enc28j60ReadReg(BANKX_ECON1) & (1<<BANKX_ECON1_TXRTS)) return;
+    nTxActive = 0;
+    nTxQueued &= (uint8_t)~(1 << nTxQueue[nTxHead]);
+    nTxHead++;
+    if (nTxHead == nTxSlots) nTxHead = 0;
+    nTxCount--;
+  }
+  if (nTxCount) Enc28j60TxStart(nTxQueue[nTxHead]);
+}
+
+
+// Adds a TX slot to the end of the queue and starts it if the transmitter
+// is idle
+static void Enc28j60TxQueue(uint8_t nSlot)
+{
+  uint8_t i;
+
+  i = (uint8_t)(nTxHead + nTxCount);
+  if (i >= nTxSlots) i -= nTxSlots;
+  nTxQueue[i] = nSlot;
+  nTxCount++;
+  nTxQueued |= (uint8_t)(1 << nSlot);
+  if (!nTxActive) Enc28j60TxStart(nSlot);
+}
+
+
+// Returns the number of bits set in nMask, i.e. the number of TX slots in a
+// slot mask
+static uint8_t Enc28j60TxCount(uint8_t nMask)
+{
+  uint8_t n;
+
+  n = 0;
+  while (nMask) {
+    n = (uint8_t)(n + (nMask & 1));
+    nMask >>= 1;
+  }
+  return n;
+}
+
+
+// Returns a TX slot that is neither queued, parked nor pinned. Must only
+// be called when there is one. Slots are searched round robin; with the
+// retransmission cache slots that do not hold a data segment are
+// preferred so segments stay available for retransmission longer.
+static uint8_t Enc28j60TxFreeSlot(void)
+{
+  uint8_t i;
+  uint8_t nSlot;
+  uint8_t nFallback;
+
+  nSlot = nTxNext;
+  nFallback = 0xff;
+  for (i = 0; i < nTxSlots; i++) {
+    if (!((nTxQueued | TX_PINNED) & (1 << nSlot))) {
+#if UIP_REXMIT_CACHE == 1
+      if (TxCache[nSlot].nLen == 0) break;
+      if (nFallback == 0xff) nFallback = nSlot;
+#else
+      break;
+#endif /* UIP_REXMIT_CACHE == 1 */
+    }
+    nSlot++;
+    if (nSlot == nTxSlots) nSlot = 0;
+  }
+  if (i == nTxSlots) nSlot = nFallback;
+
+  nTxNext = (uint8_t)(nSlot + 1);
+  if (nTxNext == nTxSlots) nTxNext = 0;
+  return nSlot;
+}
+
+
+#if PAGE_CACHE_SUPPORT == 1
+// Copies Length bytes within ENC28J60 buffer memory from Src to Dest using
+// the DMA. Neither range may cross the end of the RX buffer.
+static void Enc28j60DmaCopy(uint16_t Src, uint16_t Length, uint16_t Dest)
+{
+  Enc28j60WriteReg16(BANK0_EDMASTL, Src);
+  Enc28j60WriteReg16(BANK0_EDMANDL, Src + Length - 1);
+  Enc28j60WriteReg16(BANK0_EDMADSTL, Dest);
+  Enc28j60ClearMaskReg(BANKX_ECON1, (1<<BANKX_ECON1_CSUMEN));
+  Enc28j60SetMaskReg(BANKX_ECON1, (1<<BANKX_ECON1_DMAST));
+
+  while(Enc28j60ReadReg(BANKX_ECON1) & (1<<BANKX_ECON1_DMAST)) nop();
+}
+#endif /* PAGE_CACHE_SUPPORT == 1 */
+
+
 void Enc28j60CopyPacket(uint8_t* pBuffer, uint16_t nBytes)
 {
-  uint16_t TxEnd = ENC28J60_TXSTART + nBytes;
+  uint16_t TxStart;
+#if PAGE_CACHE_SUPPORT == 1
+  uint16_t nCopy;
+#endif /* PAGE_CACHE_SUPPORT == 1 */
   uint8_t i = 200;
 
-  // Wait for a previously buffered frame to be sent out completely
+  // Find a free TX slot. Normally one is free immediately and this returns
+  // while a previous frame is still being transmitted. Only when all slots
+  // are queued, parked or pinned do we wait for the frame on the wire to
+  // complete. Parking and pinning always leave one slot that is not held.
   // Errata Workaround: TXRTS could remain set indefinitely.
   // This workaround will wait for TXRTS to be cleared within a maximum of 100ms
-  while (i--) {
-    if (!(Enc28j60ReadReg(BANKX_ECON1) & (1<<BANKX_ECON1_TXRTS))) break;
+  Enc28j60TxPoll();
+  while (Enc28j60TxCount((uint8_t)(nTxQueued | TX_PINNED)) == nTxSlots) {
+    if (i-- == 0) {
+      // Give up on the stuck frame and free its slot
+      Enc28j60ClearMaskReg(BANKX_ECON1, (1<<BANKX_ECON1_TXRTS));
+      Enc28j60TxPoll();
+      break;
+    }
     wait_timer(500);  // Wait 500 uS
+    Enc28j60TxPoll();
   }
 
-  Enc28j60SwitchBank(BANK0);
+  nTxSlot = Enc28j60TxFreeSlot();
+  nTxSlotLen[nTxSlot] = nBytes;
+  TxStart = nTxStart + (nTxSlot * ENC28J60_TXSLOTSIZE);
 
-  Enc28j60WriteReg(BANK0_EWRPTL, (uint8_t) (ENC28J60_TXSTART >> 0));
-  Enc28j60WriteReg(BANK0_EWRPTH, (uint8_t) (ENC28J60_TXSTART >> 8));
-  Enc28j60WriteReg(BANK0_ETXNDL, (uint8_t) (TxEnd >> 0));
-  Enc28j60WriteReg(BANK0_ETXNDH, (uint8_t) (TxEnd >> 8));	
+  Enc28j60WriteReg16(BANK0_EWRPTL, TxStart);
 
-  select();
+  SpiSelect();
 
   SpiWriteByte(OPCODE_WBM);	 // Set ENC28J60 to receive transmit data
 
@@ -661,83 +1156,377 @@ void Enc28j60CopyPacket(uint8_t* pBuffer, uint16_t nBytes)
     // 	0 = The values in MACON3 will be used to determine how the packet
     //	will be transmitted
 
+#if PAGE_CACHE_SUPPORT == 1
+  // If the payload of this TCP segment is to come from the page cache only
+  // the headers (and nCacheCopyHead bytes of payload) are copied over SPI;
+  // the DMA copies the rest of the payload.
+  nCopy = 0;
+  if (nCacheCopyLen != 0) {
+    if (nBytes == UIP_LLH_LEN + UIP_IPTCPH_LEN + nCacheCopyHead + nCacheCopyLen
+     && pBuffer[12] == 0x08 && pBuffer[13] == 0x00
+     && pBuffer[TX_IP_PROTO] == UIP_PROTO_TCP) nCopy = nCacheCopyLen;
+    nCacheCopyLen = 0;
+  }
+
+  SpiWriteChunk(pBuffer, nBytes - nCopy); // Copy data to the ENC28J60 transmit buffer
+
+  SpiDeselect();
+
+  // +1 to skip Per-packet-control-byte
+  if (nCopy) Enc28j60DmaCopy(nCacheStart + nCacheCopyOffset, nCopy, TxStart + 1 + nBytes - nCopy);
+#else
   SpiWriteChunk(pBuffer, nBytes); // Copy data to the ENC28J60 transmit buffer
 
-  deselect();
+  SpiDeselect();
+#endif /* PAGE_CACHE_SUPPORT == 1 */
+
+#if UIP_ARCH_CHKSUM == 1
+  // Outgoing TCP checksums are computed by the ENC28J60 DMA
+  if (pBuffer[12] == 0x08 && pBuffer[13] == 0x00 && pBuffer[TX_IP_PROTO] == UIP_PROTO_TCP) {
+    Enc28j60TcpChecksumTx(pBuffer);
+  }
+#endif /* UIP_ARCH_CHKSUM == 1 */
+
+#if UIP_REXMIT_CACHE == 1
+  // Remember which TCP data segment (if any) the slot now holds so it can
+  // be retransmitted by Enc28j60Rexmit without rebuilding it. Segments
+  // with SYN, FIN or RST are left to uip.
+  TxCache[nTxSlot].nLen = 0;
+  if (pBuffer[12] == 0x08 && pBuffer[13] == 0x00
+   && pBuffer[TX_IP_PROTO] == UIP_PROTO_TCP
+   && !(pBuffer[TX_TCP_FLAGS] & TX_TCP_CTL)) {
+    TxCache[nTxSlot].nLen = (uint16_t)((((uint16_t)pBuffer[TX_IP_LEN] << 8) | pBuffer[TX_IP_LEN + 1])
+                          - TX_IPH_LEN - ((pBuffer[TX_TCP_OFFSET] >> 4) << 2));
+    memcpy(TxCache[nTxSlot].Tag, &pBuffer[TX_IP_DESTADDR], TX_TAG_LEN);
+  }
+#endif /* UIP_REXMIT_CACHE == 1 */
+
+#if UIP_TCP_WINDOW > 1
+  // Keep the segment until it is acknowledged if uip asked for it. If the
+  // frame is not the segment (uip_arp_out replaced it with an ARP request)
+  // nothing is pinned and uip finds the segment missing when it times out.
+  if (nTxPinNext && TxCache[nTxSlot].nLen != 0) nTxPinned |= (uint8_t)(1 << nTxSlot);
+  nTxPinNext = 0;
+#endif /* UIP_TCP_WINDOW > 1 */
 }
 
 
 void Enc28j60Send(void)
 {
-  // Errata Workaround: Reset TX Logic
-  Enc28j60SetMaskReg(BANKX_ECON1, (1<<BANKX_ECON1_TXRST));
-  Enc28j60ClearMaskReg(BANKX_ECON1, (1<<BANKX_ECON1_TXRST));
+  // Queue the frame written by the last Enc28j60CopyPacket and start it
+  // if the transmitter is idle
+  Enc28j60TxQueue(nTxSlot);
+}
 
-  // Start transmission
-  Enc28j60SetMaskReg(BANKX_ECON1, (1<<BANKX_ECON1_TXRTS));
+
+#if ARP_PARK_SUPPORT == 1
+uint8_t Enc28j60Park(uint8_t* pBuffer, uint16_t nBytes)
+{
+  // At least one slot must stay available for other frames, including
+  // the ARP request itself
+  if ((uint8_t)(Enc28j60TxCount(TX_PINNED) + 2) > nTxSlots) return 0;
+
+  Enc28j60ParkDrop();
+  Enc28j60CopyPacket(pBuffer, nBytes);
+  nTxParked = nTxSlot;
+  nTxQueued |= (uint8_t)(1 << nTxSlot);
+  return 1;
 }
 
 
-/*
-void Enc28j60SetClockPrescaler(uint8_t nPrescaler)
+void Enc28j60ParkRelease(uint8_t* pAddr)
 {
-  // Note: This routine doesn't appear to get called
-  //
-  // Note: After Power-On Reset the ECOCON register defaults to
-  // 0x04 {6.125MHz output on CLKOUT).
-  //
-  // Note: If the CLKOUT is not used this code could be reduced to
-  // just setting ECOCON to 0x00 to reduce power
+  uint8_t nSlot;
 
-  Enc28j60SwitchBank(BANK3);
+  if (nTxParked == 0xff) return;
+  nSlot = nTxParked;
+  nTxParked = 0xff;
+  nTxQueued &= (uint8_t)~(1 << nSlot);
 
-  if (nPrescaler == 0) Enc28j60WriteReg(BANK3_ECOCON, 0x00);      // Disable CLKOUT
-  else if (nPrescaler == 1) Enc28j60WriteReg(BANK3_ECOCON, 0x01); // CLKOUT = 25 MHz
-  else if (nPrescaler == 2) Enc28j60WriteReg(BANK3_ECOCON, 0x02); // CLKOUT = 12.5 MHz
-  else if (nPrescaler == 3) Enc28j60WriteReg(BANK3_ECOCON, 0x03); // CLKOUT = 8.333333 MHz
-  else if (nPrescaler == 4) Enc28j60WriteReg(BANK3_ECOCON, 0x04); // CLKOUT = 6.25 MHz
-  else if (nPrescaler == 8) Enc28j60WriteReg(BANK3_ECOCON, 0x05); // CLKOUT = 3.125 MHz
+  // Fill in the Ethernet destination address
+  // +1 to skip Per-packet-control-byte
+  Enc28j60WriteReg16(BANK0_EWRPTL, nTxStart + (nSlot * ENC28J60_TXSLOTSIZE) + 1);
+  SpiSelect();
+  SpiWriteByte(OPCODE_WBM);
+  SpiWriteChunk(pAddr, 6);
+  SpiDeselect();
+
+  Enc28j60TxQueue(nSlot);
 }
 
 
-uint16_t Enc28j60ChecksumTx(uint16_t Offset, uint16_t Length)
+void Enc28j60ParkDrop(void)
 {
-  // Note: This routine doesn't appear to get called
+  if (nTxParked == 0xff) return;
+#if UIP_REXMIT_CACHE == 1
+  // The frame has no destination address, so it must not be retransmitted
+  TxCache[nTxParked].nLen = 0;
+#endif /* UIP_REXMIT_CACHE == 1 */
+#if UIP_TCP_WINDOW > 1
+  nTxPinned &= (uint8_t)~(1 << nTxParked);
+#endif /* UIP_TCP_WINDOW > 1 */
+  nTxQueued &= (uint8_t)~(1 << nTxParked);
+  nTxParked = 0xff;
+}
+#endif /* ARP_PARK_SUPPORT == 1 */
+
+
+#if UIP_REXMIT_CACHE == 1
+// Returns 1 if the TX slot holds a TCP data segment of the connection
+static uint8_t Enc28j60TxConn(uint8_t nSlot, struct uip_conn* conn)
+{
+  return (uint8_t)(TxCache[nSlot].nLen != 0
+    && memcmp(&TxCache[nSlot].Tag[0], conn->ripaddr, 4) == 0
+    && memcmp(&TxCache[nSlot].Tag[4], &conn->lport, 2) == 0
+    && memcmp(&TxCache[nSlot].Tag[6], &conn->rport, 2) == 0);
+}
+
+
+#if UIP_TCP_WINDOW > 1
+// Returns the pinned TX slot holding the segment of the connection that
+// starts at sequence number Seq, 0xff if there is none
+static uint8_t Enc28j60TxPinned(struct uip_conn* conn, uint32_t Seq)
+{
+  uint8_t nSlot;
+
+  for (nSlot = 0; nSlot < nTxSlots; nSlot++) {
+    if ((nTxPinned & (1 << nSlot))
+     && Enc28j60TxConn(nSlot, conn)
+     && uip_get32(&TxCache[nSlot].Tag[8]) == Seq) return nSlot;
+  }
+  return 0xff;
+}
+
+
+uint8_t Enc28j60CanPin(void)
+{
+#if ARP_PARK_SUPPORT == 1
+  // A parked frame is dropped when the next one is parked, which would
+  // leave a hole in a window. No segment is pinned while one waits for
+  // its ARP reply.
+  if (nTxParked != 0xff) return 0;
+#endif /* ARP_PARK_SUPPORT == 1 */
+  // One slot must stay available for frames that are not pinned
+  return (uint8_t)(Enc28j60TxCount(nTxPinned) + 2 <= nTxSlots);
+}
+
+
+uint8_t Enc28j60Pinned(struct uip_conn* conn)
+{
+  uint8_t nSlot;
+  uint8_t nCount;
+
+  nCount = 0;
+  for (nSlot = 0; nSlot < nTxSlots; nSlot++) {
+    if ((nTxPinned & (1 << nSlot)) && Enc28j60TxConn(nSlot, conn)) nCount++;
+  }
+  return nCount;
+}
+
+
+void Enc28j60PinNext(void)
+{
+  nTxPinNext = 1;
+}
+
+
+uint8_t Enc28j60Acked(struct uip_conn* conn, uint32_t Ackno, uint16_t* pBytes)
+{
+  // Walk the pinned segments in sequence order starting at snd_nxt and
+  // release every one that Ackno covers completely. Segments are only
+  // released in order, so a partial ACK leaves the rest pinned.
+  uint8_t nSlot;
+  uint8_t nCount;
+  uint32_t Seq;
+
+  nCount = 0;
+  *pBytes = 0;
+  Seq = conn->snd_nxt;
+  while ((nSlot = Enc28j60TxPinned(conn, Seq)) != 0xff) {
+    if ((int32_t)(Ackno - (Seq + TxCache[nSlot].nLen)) < 0) break;
+    nTxPinned &= (uint8_t)~(1 << nSlot);
+    Seq += TxCache[nSlot].nLen;
+    *pBytes += TxCache[nSlot].nLen;
+    nCount++;
+  }
+  return nCount;
+}
+
 
+void Enc28j60Unpin(struct uip_conn* conn)
+{
+  uint8_t nSlot;
+
+  for (nSlot = 0; nSlot < nTxSlots; nSlot++) {
+    if (Enc28j60TxConn(nSlot, conn)) nTxPinned &= (uint8_t)~(1 << nSlot);
+  }
+}
+#endif /* UIP_TCP_WINDOW > 1 */
+
+
+uint8_t Enc28j60Rexmit(struct uip_conn* conn)
+{
+  // Look for the unacknowledged segment of the connection in the TX
+  // slots. It must still carry the current ackno, otherwise uip has to
+  // rebuild it. A slot that is still queued is not queued twice.
+  uint8_t nSlot;
+
+#if UIP_TCP_WINDOW > 1
+  // Pinned segments are all queued again in sequence order (go-back-N).
+  // Their ackno may be stale, which the peer accepts. If the newest
+  // segment was not pinned uip still has to rebuild it.
+  uint32_t Seq;
+
+  Enc28j60TxPoll();
+  Seq = conn->snd_nxt;
+  while ((nSlot = Enc28j60TxPinned(conn, Seq)) != 0xff) {
+    if (!(nTxQueued & (1 << nSlot))) Enc28j60TxQueue(nSlot);
+    Seq += TxCache[nSlot].nLen;
+  }
+  if (Seq != conn->snd_nxt && Seq == conn->snd_nxt + conn->len) return 1;
+#endif /* UIP_TCP_WINDOW > 1 */
+
+  for (nSlot = 0; nSlot < nTxSlots; nSlot++) {
+    if (TxCache[nSlot].nLen == conn->len
+     && Enc28j60TxConn(nSlot, conn)
+     && uip_get32(&TxCache[nSlot].Tag[8]) == conn->snd_nxt
+     && uip_get32(&TxCache[nSlot].Tag[12]) == conn->rcv_nxt) {
+      Enc28j60TxPoll();
+      if (!(nTxQueued & (1 << nSlot))) Enc28j60TxQueue(nSlot);
+      return 1;
+    }
+  }
+  return 0;
+}
+#endif /* UIP_REXMIT_CACHE == 1 */
+
+
+#if UIP_ARCH_CHKSUM == 1
+// Generates a checksum over a range of the frame in the TX slot written by
+// the last Enc28j60CopyPacket, using the ENC28J60 DMA checksum engine.
+// Offset is relative to the start of the frame.
+uint16_t Enc28j60ChecksumTx(uint16_t Offset, uint16_t Length)
+{
   // +1 to skip Per-packet-control-byte
-  uint16_t Start = ENC28J60_TXSTART + Offset + 1;
+  uint16_t Start = nTxStart + (nTxSlot * ENC28J60_TXSLOTSIZE) + Offset + 1;
   uint16_t End = Start + Length - 1;
+  uint16_t Checksum;
+  uint8_t i = 15;
+
+  // Errata Workaround (B7 DMA): A packet received while the DMA is
+  // computing a checksum may be lost or corrupted. Hold off reception
+  // first so no new frame can start, then let any frame that is already
+  // arriving finish (a maximum size frame takes about 1.2ms at 10Mbps)
+  // before the DMA operation is started.
+  Enc28j60ClearMaskReg(BANKX_ECON1, (1<<BANKX_ECON1_RXEN));
+  while (i--) {
+    if (!(Enc28j60ReadReg(BANKX_ESTAT) & (1<<BANKX_ESTAT_RXBUSY))) break;
+    wait_timer(100);  // Wait 100 uS
+  }
 
-  Enc28j60SwitchBank(BANK0);
-  Enc28j60WriteReg(BANK0_EDMASTL, (uint8_t) (Start >> 0));
-  Enc28j60WriteReg(BANK0_EDMASTH, (uint8_t) (Start >> 8));
-  Enc28j60WriteReg(BANK0_EDMANDL, (uint8_t) (End >> 0));
-  Enc28j60WriteReg(BANK0_EDMANDH, (uint8_t) (End >> 8));
+  Enc28j60WriteReg16(BANK0_EDMASTL, Start);
+  Enc28j60WriteReg16(BANK0_EDMANDL, End);
   Enc28j60SetMaskReg(BANKX_ECON1, (1<<BANKX_ECON1_CSUMEN) | (1<<BANKX_ECON1_DMAST));
 
   while(Enc28j60ReadReg(BANKX_ECON1) & (1<<BANKX_ECON1_DMAST)) nop();
 
-  return ((uint16_t) Enc28j60ReadReg(BANK0_EDMACSH) << 8) | ((uint16_t) Enc28j60ReadReg(BANK0_EDMACSL) << 0);
+  Enc28j60ClearMaskReg(BANKX_ECON1, (1<<BANKX_ECON1_CSUMEN));
+  Enc28j60SetMaskReg(BANKX_ECON1, (1<<BANKX_ECON1_RXEN));
+
+  Checksum = ((uint16_t) Enc28j60ReadReg(BANK0_EDMACSH) << 8) | ((uint16_t) Enc28j60ReadReg(BANK0_EDMACSL) << 0);
+  return Checksum;
 }
 
 
+// Copies a checksum into the TX slot written by the last
+// Enc28j60CopyPacket at Offset from the start of the frame
 void Enc28j60CopyChecksum(uint16_t Offset, uint16_t Checksum)
 {
-  // Note: This routine doesn't appear to get called
-
   // +1 to skip Per-packet-control-byte
-  uint16_t WrPtr = ENC28J60_TXSTART + Offset + 1;
+  uint16_t WrPtr = nTxStart + (nTxSlot * ENC28J60_TXSLOTSIZE) + Offset + 1;
+
+  Enc28j60WriteReg16(BANK0_EWRPTL, WrPtr);
+
+  SpiSelect();
+
+  // Network byte order whatever the CPU byte order is
+  SpiWriteByte(OPCODE_WBM);
+  SpiWriteByte((uint8_t)(Checksum >> 8));
+  SpiWriteByte((uint8_t)Checksum);
 
-  Enc28j60SwitchBank(BANK0);
+  SpiDeselect();
+}
+
+
+// Computes the TCP checksum of the TCP/IP frame in the TX slot written by
+// the last Enc28j60CopyPacket and patches it into the frame. uip leaves
+// the checksum field zero when UIP_ARCH_CHKSUM == 1.
+// The DMA checksums the IP source and destination addresses plus the
+// whole TCP segment, which are contiguous in the frame. The rest of the
+// pseudo header (protocol and TCP length) is added here.
+void Enc28j60TcpChecksumTx(uint8_t* pBuffer)
+{
+  uint16_t nTcpLen;
+  uint32_t nSum;
 
-  Enc28j60WriteReg(BANK0_EWRPTL, (uint8_t) (WrPtr >> 0));
-  Enc28j60WriteReg(BANK0_EWRPTH, (uint8_t) (WrPtr >> 8));
+  nTcpLen = (uint16_t)((((uint16_t)pBuffer[TX_IP_LEN] << 8) | pBuffer[TX_IP_LEN + 1]) - TX_IPH_LEN);
 
-  select();
+  nSum = (uint16_t)~Enc28j60ChecksumTx(TX_IP_SRCADDR, (uint16_t)(8 + nTcpLen));
+  nSum += UIP_PROTO_TCP;
+  nSum += nTcpLen;
+  while (nSum >> 16) nSum = (nSum & 0xffff) + (nSum >> 16);
+
+  Enc28j60CopyChecksum(TX_TCP_CHKSUM, (uint16_t)~nSum);
+}
+#endif /* UIP_ARCH_CHKSUM == 1 */
+
+
+#if PAGE_CACHE_SUPPORT == 1
+uint16_t Enc28j60CacheSize(void)
+{
+  return nCacheSize;
+}
+
+
+void Enc28j60CacheWrite(uint16_t Offset, uint8_t* pBuffer, uint16_t nBytes)
+{
+  Enc28j60WriteReg16(BANK0_EWRPTL, nCacheStart + Offset);
+
+  SpiSelect();
 
   SpiWriteByte(OPCODE_WBM);
-  SpiWriteChunk((uint8_t*) &Checksum, sizeof(Checksum));
+  SpiWriteChunk(pBuffer, nBytes);
+
+  SpiDeselect();
+}
 
-  deselect();
+
+void Enc28j60CacheAttach(uint16_t Offset, uint16_t nBytes, uint16_t nHead)
+{
+  nCacheCopyOffset = Offset;
+  nCacheCopyLen = nBytes;
+  nCacheCopyHead = nHead;
 }
+#endif /* PAGE_CACHE_SUPPORT == 1 */
+
+
+/*
+void Enc28j60SetClockPrescaler(uint8_t nPrescaler)
+{
+  // Note: This routine doesn't appear to get called
+  //
+  // Note: After Power-On Reset the ECOCON register defaults to
+  // 0x04 {6.125MHz output on CLKOUT).
+  //
+  // Note: If the CLKOUT is not used this code could be reduced to
+  // just setting ECOCON to 0x00 to reduce power
+
+  if (nPrescaler == 0) Enc28j60WriteReg(BANK3_ECOCON, 0x00);      // Disable CLKOUT
+  else if (nPrescaler == 1) Enc28j60WriteReg(BANK3_ECOCON, 0x01); // CLKOUT = 25 MHz
+  else if (nPrescaler == 2) Enc28j60WriteReg(BANK3_ECOCON, 0x02); // CLKOUT = 12.5 MHz
+  else if (nPrescaler == 3) Enc28j60WriteReg(BANK3_ECOCON, 0x03); // CLKOUT = 8.333333 MHz
+  else if (nPrescaler == 4) Enc28j60WriteReg(BANK3_ECOCON, 0x04); // CLKOUT = 6.25 MHz
+  else if (nPrescaler == 8) Enc28j60WriteReg(BANK3_ECOCON, 0x05); // CLKOUT = 3.125 MHz
+}
+
 */
@@ -63,13 +63,30 @@
 #define ENC28J60_SCK		PB5
 
 // OnChip Buffer locations
+// The RX buffer runs from RXSTART up to the TX buffer, which ends at TXEND.
+// Where the two meet is set at runtime by the partition in enc28j60_config.
 // Errata Workaround: RX Buffer should start at 0x0000
-// Errata Workaround: RXEND should not be even!
-#define ENC28J60_RXSTART	0x0000	//6kb
-#define ENC28J60_RXEND		0x17FF
-#define ENC28J60_TXSTART	0x1800	//2kb
+// Errata Workaround: RXEND should not be even! (TXSTART is always even)
+#define ENC28J60_RXSTART	0x0000
 #define ENC28J60_TXEND		0x1FFF
 
+// The TX buffer is split into slots so the next frame can be written
+// while the previous one is still being transmitted. Each slot must hold
+// the per packet control byte, ENC28J60_MAXFRAME bytes and the 7 byte
+// transmit status vector. ENC28J60_TXSLOTS is the largest number of
+// slots any partition uses.
+#define ENC28J60_TXSLOTS	4
+#define ENC28J60_TXSLOTSIZE	1024
+
+// enc28j60_config bits. The value is set on the Address Settings page,
+// stored in EEPROM and applied by Enc28j60Init. A value of 0 means "not
+// set" and is replaced by the defaults from uipopt.h.
+// Bits 0-2: Number of 1KB TX slots (1 to ENC28J60_TXSLOTS). The rest of
+//           the 8KB buffer memory is the RX buffer.
+// Bit 3:    Full duplex
+#define ENC28J60_CFG_TXSLOTS	0x07
+#define ENC28J60_CFG_FULDPX	0x08
+
 // LED configuration bits:
 // LEDA: Transmit
 // LEDB: Link & receive
@@ -90,22 +107,106 @@
 // having a large MAXFRAME.
 #define ENC28J60_MAXFRAME	900
 
+#if ENC28J60_TXSLOTSIZE < (1 + ENC28J60_MAXFRAME + 7)
+#error "ENC28J60_TXSLOTSIZE is too small for ENC28J60_MAXFRAME"
+#endif
+
+// One bit per slot is kept in a uint8_t
+#if ENC28J60_TXSLOTS > 8
+#error "ENC28J60_TXSLOTS must not exceed 8"
+#endif
+
 // Use this for function inlining within the ENC28J60 module
 #define ENC28J60_INLINE		static inline __attribute__ ((always_inline))
 
+// Set by the -INT interrupt handler when the ENC28J60 signals that a
+// packet has been received. Only used when RX_INTERRUPT_SUPPORT == 1.
+extern volatile uint8_t enc28j60_rx_pending;
+
 // Initialize Chip (Initialize used SPI module before!)
 void Enc28j60Init(void);
 
+// Port C external interrupt handler for the ENC28J60 -INT output
+@far @interrupt void Enc28j60Interrupt(void);
+
+// Programs the receive pattern match filter for ARP requests to our IP
+// address (RX_FILTER_SUPPORT == 1). Called by Enc28j60Init.
+void Enc28j60SetArpPattern(void);
+
 // Receives an Ethernet-frame. If non available it returns zero
 // This function will never receive more than ENC28J60_MAXFRAME bytes
+// Frames that are not ARP or IP addressed to this device are discarded
+// after reading only their header, and also return zero
 uint16_t Enc28j60Receive(uint8_t* pBuffer);
 
-// Copies a packet into ENC28J60's buffer
+// Copies a packet into a free slot of ENC28J60's TX buffer
+// Only waits if every TX slot is already queued for transmission
 void Enc28j60CopyPacket(uint8_t* pBuffer, uint16_t nBytes);
 
-// Sends a previously copied ethernet frame
+// Queues a previously copied ethernet frame for transmission
 void Enc28j60Send(void);
 
+// Starts the next queued frame once the previous one has been sent
+// Must be called regularly from the main loop
+void Enc28j60TxPoll(void);
+
+// Returns a valid enc28j60_config value, replacing an unset or invalid
+// one with the defaults from uipopt.h
+uint8_t Enc28j60CheckConfig(uint8_t nConfig);
+
+// Retransmits the unacknowledged segment of a connection straight from
+// ENC28J60's TX buffer if a TX slot still holds it (UIP_REXMIT_CACHE == 1).
+// Returns 1 if the segment was queued again, 0 if uip must rebuild it.
+// With UIP_TCP_WINDOW > 1 the pinned segments are queued again and 1 is
+// returned if they hold all the outstanding data.
+struct uip_conn;
+uint8_t Enc28j60Rexmit(struct uip_conn* conn);
+
+// Sliding window support (UIP_TCP_WINDOW > 1). A pinned TX slot keeps its
+// TCP segment until the segment is acknowledged, so several segments can be
+// in flight and Enc28j60Rexmit can send all of them again.
+// Returns 1 if another segment can be pinned
+uint8_t Enc28j60CanPin(void);
+
+// Pins the slot of the next TCP data segment passed to Enc28j60CopyPacket
+void Enc28j60PinNext(void);
+
+// Returns the number of segments of a connection that are pinned. A segment
+// uip asked to pin is not if its frame was replaced by an ARP request.
+uint8_t Enc28j60Pinned(struct uip_conn* conn);
+
+// Unpins the segments of a connection that Ackno acknowledges, starting at
+// conn->snd_nxt. Returns the number of segments and their length in pBytes.
+uint8_t Enc28j60Acked(struct uip_conn* conn, uint32_t Ackno, uint16_t* pBytes);
+
+// Unpins all segments of a connection
+void Enc28j60Unpin(struct uip_conn* conn);
+
+// Copies a frame into a TX slot and holds it there instead of sending it,
+// until the Ethernet address of its next hop is known (ARP_PARK_SUPPORT == 1).
+// Only one frame is parked; a new one replaces it. Returns 0 if no TX slot
+// can be spared, in which case nothing was copied.
+uint8_t Enc28j60Park(uint8_t* pBuffer, uint16_t nBytes);
+
+// Fills in the Ethernet destination address of the parked frame and queues
+// it for transmission
+void Enc28j60ParkRelease(uint8_t* pAddr);
+
+// Discards the parked frame
+void Enc28j60ParkDrop(void);
+
+// Page cache in ENC28J60 buffer memory (PAGE_CACHE_SUPPORT == 1)
+// Returns the size of the cache in bytes, 0 if there is no room for it
+uint16_t Enc28j60CacheSize(void);
+
+// Copies nBytes from pBuffer into the cache at Offset
+void Enc28j60CacheWrite(uint16_t Offset, uint8_t* pBuffer, uint16_t nBytes);
+
+// Makes nBytes of the cache at Offset the payload of the next TCP segment
+// passed to Enc28j60CopyPacket, following nHead bytes of payload that are
+// in pBuffer. The rest of the payload in pBuffer is not copied then.
+void Enc28j60CacheAttach(uint16_t Offset, uint16_t nBytes, uint16_t nHead);
+
 // Use this function to control onchip clock-prescaling
 // provided by the ENC28J60 for using as the host processor's main clock
 // Startup default is ENC28J60's clock divided by 4 (6.25MHz)
@@ -114,9 +215,13 @@ void Enc28j60Send(void);
 
 // Generates a checksum over a given range in ENC28J60's TX buffer
 // using ENC28J60's own checksum generation function.
-// uint16_t Enc28j60ChecksumTx(uint16_t Offset, uint16_t Length);
+uint16_t Enc28j60ChecksumTx(uint16_t Offset, uint16_t Length);
 
 // Copies data into ENC28J60's TX buffer at Offset
-// void Enc28j60CopyChecksum(uint16_t Offset, uint16_t Checksum);
+void Enc28j60CopyChecksum(uint16_t Offset, uint16_t Checksum);
+
+// Computes and inserts the TCP checksum of the frame in ENC28J60's TX
+// buffer (UIP_ARCH_CHKSUM == 1). Called by Enc28j60CopyPacket.
+void Enc28j60TcpChecksumTx(uint8_t* pBuffer);
 
 #endif /*ENC28J60_H_*/
@@ -62,6 +62,7 @@
 // 
 // EEPROM Operating Code Variables:
 // >>> Add new variables HERE <<<
+@eeprom uint8_t stored_enc28j60_config;	// ENC28J60 duplex mode and buffer partition
 @eeprom uint8_t magic4;			// MSB Magic Number stored in EEPROM
 @eeprom uint8_t magic3;			//
 @eeprom uint8_t magic2;			//
@@ -113,6 +114,7 @@ uint8_t IO_16to9;                  // Stores the IO states
 uint8_t IO_8to1;                   // Stores the IO states
 uint8_t invert_output;             // Stores the relay control pin invert
 uint8_t ex_stored_devicename[20];  // Device name
+uint8_t enc28j60_config;           // ENC28J60 duplex mode and buffer partition
 /*---------------------------------------------------------------------------*/
 
 /*---------------------------------------------------------------------------*/
@@ -144,6 +146,8 @@ uint8_t Pending_uip_ethaddr3;
 uint8_t Pending_uip_ethaddr2;
 uint8_t Pending_uip_ethaddr1;
 
+uint8_t Pending_enc28j60_config;
+
 uint8_t uip_ethaddr6;
 uint8_t uip_ethaddr5;
 uint8_t uip_ethaddr4;
@@ -192,12 +196,22 @@ main(void)
 
   HttpDInit();             // Initialize listening ports
 
+#if UIP_ARP_ANNOUNCE > 0
+  uip_arp_announce_start(); // Tell the network our IP and MAC address
+#endif /* UIP_ARP_ANNOUNCE > 0 */
+
+#if RX_INTERRUPT_SUPPORT == 1
+  _asm("rim");             // Enable interrupts (ENC28J60 -INT)
+#endif /* RX_INTERRUPT_SUPPORT == 1 */
+
   while (1) {
+    Enc28j60TxPoll();                   // Start any queued outgoing frame
+
     uip_len = Enc28j60Receive(uip_buf); // Check for incoming packets
 
     if (uip_len> 0) {
       if (((struct uip_eth_hdr *) & uip_buf[0])->type == htons(UIP_ETHTYPE_IP)) {
-	// uip_arp_ipin();
+	uip_arp_ipin(); // Learn the sender's MAC address
 	uip_input(); // Calls uip_process(UIP_DATA) to process incoming packet
 	// If the above process resulted in data that should be sent out on the
 	// network the global variable uip_len will have been set to a value > 0.
@@ -209,6 +223,9 @@ main(void)
           Enc28j60CopyPacket(uip_buf, uip_len);
           Enc28j60Send();
         }
+#if UIP_TCP_WINDOW > 1
+        fill_tcp_window();
+#endif /* UIP_TCP_WINDOW > 1 */
       }
       else if (((struct uip_eth_hdr *) & uip_buf[0])->type == htons(UIP_ETHTYPE_ARP)) {
         uip_arp_arpin();
@@ -224,7 +241,39 @@ main(void)
       }
     }
 
+#if UIP_ARP_ANNOUNCE > 0
+    uip_arp_announce();
+    // If an ARP announcement is due the global variable uip_len will have
+    // been set to a value > 0.
+    if (uip_len > 0) {
+      Enc28j60CopyPacket(uip_buf, uip_len);
+      Enc28j60Send();
+    }
+#endif /* UIP_ARP_ANNOUNCE > 0 */
+
+    // Retransmission time-outs are kept in milliseconds, so they are
+    // checked on every pass instead of with the periodic timer.
+    for(i = 0; i < UIP_CONNS; i++) {
+      uip_rexmit_timer(i);
+      // If a segment is due for retransmission the global variable uip_len
+      // will have been set to a value > 0.
+      if (uip_len > 0) {
+        uip_arp_out();
+        Enc28j60CopyPacket(uip_buf, uip_len);
+        Enc28j60Send();
+      }
+    }
+
     if (periodic_timer_expired()) {
+#if UIP_ARP_ANNOUNCE > 0
+      uip_arp_announce_timer();
+#endif /* UIP_ARP_ANNOUNCE > 0 */
+#if RX_INTERRUPT_SUPPORT == 1
+      // Errata: EIR.PKTIF does not reliably report pending packets, so
+      // check the packet counter at least once per periodic tick even if
+      // no -INT edge was seen.
+      enc28j60_rx_pending = 1;
+#endif /* RX_INTERRUPT_SUPPORT == 1 */
       for(i = 0; i < UIP_CONNS; i++) {
 	uip_periodic(i);
 	// If the above process resulted in data that should be sent out on the
@@ -237,6 +286,9 @@ main(void)
           Enc28j60CopyPacket(uip_buf, uip_len);
           Enc28j60Send();
 	}
+#if UIP_TCP_WINDOW > 1
+        fill_tcp_window();
+#endif /* UIP_TCP_WINDOW > 1 */
       }
     }
 
@@ -341,6 +393,12 @@ void check_eeprom_settings(void)
     
     // Set the device name
     for(i=0; i<20; i++) { ex_stored_devicename[i] = stored_devicename[i]; }
+
+    // Read and use the ENC28J60 configuration from EEPROM. Code updates
+    // that add this setting find it cleared, in which case the defaults
+    // are used and stored.
+    enc28j60_config = Enc28j60CheckConfig(stored_enc28j60_config);
+    if (stored_enc28j60_config != enc28j60_config) stored_enc28j60_config = enc28j60_config;
     
     // Read and use the Relay states from EEPROM
     invert_output = stored_invert_output;
@@ -448,6 +506,10 @@ void check_eeprom_settings(void)
     stored_devicename[18] = ' ' ; //
     stored_devicename[19] = ' ' ; // Device name last character
 
+    // Write the default ENC28J60 configuration to EEPROM
+    enc28j60_config = Enc28j60CheckConfig(0);
+    stored_enc28j60_config = enc28j60_config;
+
     // Turn all Relays controls to 0 and store the state in EEPROM.
     invert_output = 0;                  // Turn off output invert bit
     stored_invert_output = 0;           // Store in EEPROM
@@ -499,6 +561,8 @@ void check_eeprom_settings(void)
   Pending_uip_ethaddr2 = stored_uip_ethaddr2;
   Pending_uip_ethaddr1 = stored_uip_ethaddr1;
 
+  Pending_enc28j60_config = stored_enc28j60_config;
+
   // Set the ex_stored values for use in the GUI display
   ex_stored_hostaddr4 = stored_hostaddr4;
   ex_stored_hostaddr3 = stored_hostaddr3;
@@ -522,6 +586,27 @@ void check_eeprom_settings(void)
 }
 
 
+#if UIP_TCP_WINDOW > 1
+void fill_tcp_window(void)
+{
+  // The connection uip just processed may have room in its send window for
+  // more segments. Poll the application for them until the window is full
+  // or the application has nothing more to send.
+  struct uip_conn *conn;
+
+  conn = uip_conn;
+  if (conn == 0) return;
+  while (uip_window_open(conn)) {
+    uip_poll_conn(conn);
+    if (uip_len == 0) break;
+    uip_arp_out();
+    Enc28j60CopyPacket(uip_buf, uip_len);
+    Enc28j60Send();
+  }
+}
+#endif /* UIP_TCP_WINDOW > 1 */
+
+
 void check_runtime_changes(void)
 {
   // Check if the user requested changes to Relay state, IP Address,
@@ -641,9 +726,19 @@ void check_runtime_changes(void)
     submit_changes = 1;
   }
 
+  // Check for changes in the ENC28J60 duplex mode and buffer partition
+  if (stored_enc28j60_config != Pending_enc28j60_config) {
+    // Write the new configuration to the EEPROM. Enc28j60Init applies it
+    // when the software restarts.
+    stored_enc28j60_config = Enc28j60CheckConfig(Pending_enc28j60_config);
+    Pending_enc28j60_config = stored_enc28j60_config;
+    submit_changes = 1;
+  }
+
   if (submit_changes == 1) {
     // submit_changes = 1 indicates we need run through the processes to apply
-    // IP Address, Gateway Address, Netmask, Port number, and/or MAC. This is
+    // IP Address, Gateway Address, Netmask, Port number, MAC, and/or the
+    // ENC28J60 configuration. This is
     // similar to a hardware reset except the GPIO pins which control the
     // relays are not reset thus preventing relay "chatter" that a hardware
     // reset would cause.
@@ -653,6 +748,9 @@ void check_runtime_changes(void)
     uip_arp_init();          // Initialize the ARP module
     uip_init();              // Initialize uIP
     HttpDInit();             // Initialize httpd; sets up listening ports
+#if UIP_ARP_ANNOUNCE > 0
+    uip_arp_announce_start(); // Tell the network our new IP and MAC address
+#endif /* UIP_ARP_ANNOUNCE > 0 */
     submit_changes = 0;
   }
 
@@ -930,6 +1028,7 @@ void check_reset_button(void)
     stored_IO_16to9 = 0x00;        // IO States 16 to 9
     stored_IO_8to1 = 0x00;         // IO States 8 to 1
     stored_invert_output = 0x00;   // Relay state inversion control
+    stored_enc28j60_config = 0x00; // ENC28J60 duplex mode and buffer partition
     
     stored_devicename[0] = 0x00;   // Device name
     stored_devicename[1] = 0x00;   // Device name
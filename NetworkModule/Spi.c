@@ -47,6 +47,7 @@
 
 #include "Spi.h"
 #include "timer.h"
+#include "uipopt.h"
 #include "iostm8s005.h"
 #include "stm8s-005.h"
 
@@ -60,7 +61,7 @@ void spi_init(void)
   
   // The GPIO pins used for SPI bit bang are:
   // Port C
-  //   Bit 5 - Pin 30 - Input  - ENC28J60 -INT (not used)
+  //   Bit 5 - Pin 30 - Input  - ENC28J60 -INT
   //   Bit 4 - Pin 29 - Input  - ENC28J60 SO
   //   Bit 3 - Pin 28 - Output - ENC28J60 SI
   //   Bit 2 - Pin 27 - Output - ENC28J60 SCK
@@ -83,8 +84,17 @@ void spi_init(void)
   // wait 50ms
   wait_timer((uint16_t)50000); // Wait 50ms
 
-  // From this point forward the -RESET output and -INT input should 
-  // not be needed.
+#if RX_INTERRUPT_SUPPORT == 1
+  // Enable the Port C interrupt on PC5 (ENC28J60 -INT). EXTI_CR1 can
+  // only be written while interrupts are disabled, which is the case
+  // here as main() only enables interrupts after all initialization.
+  EXTI_CR1 &= (uint8_t)(~EXTI_CR1_PCIS);
+  EXTI_CR1 |= (uint8_t)0x20;  // Port C falling edge only
+  PC_CR2 |= (uint8_t)0x20;    // PC5 interrupt enabled
+#endif /* RX_INTERRUPT_SUPPORT == 1 */
+
+#if SPI_SUPPORT == 1
+  // From this point forward the -RESET output should not be needed.
   // Use the following functions to work with the SPI output pins
   // PC_ODR |= (uint8_t)0x02;    // -CS high
   // PC_ODR &= (uint8_t)(~0x02); // -CS low
@@ -96,57 +106,124 @@ void spi_init(void)
   // if (PC_IDR & (uint8_t)(~0x10))==1 databit = 1;
   // else databit = 0;
   //
+#endif /* SPI_SUPPORT == 1 */
+
+#if SPI_SUPPORT == 2
+  // Hardware SPI on a rewired module. The ENC28J60 SPI lines are moved
+  // to the STM8 SPI peripheral pins:
+  // Port C
+  //   Bit 7 - Pin 34 - Input  - SPI MISO (ENC28J60 SO)
+  //   Bit 6 - Pin 33 - Output - SPI MOSI (ENC28J60 SI)
+  //   Bit 5 - Pin 30 - Output - SPI SCK  (ENC28J60 SCK)
+  //   Bit 1 - Pin 26 - Output - ENC28J60 -CS (still driven as GPIO)
+  // The gpio_init() Port C settings for Relay 8 and Relay 16 are
+  // overridden here as those pins now belong to the SPI peripheral.
+  PC_DDR &= (uint8_t)(~0x80);  // MISO is an input
+  PC_CR2 &= (uint8_t)(~0x80);  // MISO interrupt disabled
+  PC_DDR |= (uint8_t)0x60;     // SCK and MOSI are outputs
+  PC_CR1 |= (uint8_t)0x60;     // SCK and MOSI are Push-Pull
+  PC_CR2 |= (uint8_t)0x60;     // SCK and MOSI are 10MHz/Fast Mode
+
+  // The SPI clock is left enabled by clock_init() when SPI_SUPPORT == 2.
+  // Master mode, software slave management, MSB first, CPOL=0 CPHA=0
+  // (SPI mode 0,0 as required by the ENC28J60), baud rate fMASTER/2
+  // which is 8MHz.
+  SPI_CR2 = (uint8_t)(SPI_CR2_SSM | SPI_CR2_SSI);
+  SPI_CR1 = (uint8_t)SPI_CR1_MSTR;  // BR = 000 = fMASTER/2
+  SPI_CR1 |= (uint8_t)SPI_CR1_SPE;  // Enable SPI
+#endif /* SPI_SUPPORT == 2 */
+}
+
+
+#if SPI_SUPPORT == 1 || SPI_SUPPORT == 2
+void SpiSelect(void)
+{
+  // -CS low
+  PC_ODR &= (uint8_t)(~0x02);
+  nop();
+}
+
+
+void SpiDeselect(void)
+{
+  // -CS high
+  PC_ODR |= (uint8_t)0x02;
+  nop();
 }
+#endif /* SPI_SUPPORT == 1 || SPI_SUPPORT == 2 */
+
+
+#if SPI_SUPPORT == 1
+// The bit bang transfer is fully unrolled. Each bit is a constant mask
+// test followed by single bit set/clear operations on the Port C
+// registers, which the Cosmic compiler emits as BSET / BRES / BTJT
+// instructions. There is no loop counter, no shift of a bit pointer and
+// no nop() padding. At 16MHz one instruction cycle is 62.5ns which
+// already exceeds the ENC28J60 SCK high / low and data setup times.
+//
+// Pin usage (see spi_init above):
+//   PC_ODR 0x08 - SPI SO (ENC28J60 SI)
+//   PC_ODR 0x04 - SCK
+//   PC_IDR 0x10 - SPI SI (ENC28J60 SO)
+
+// Output one bit of OutByte selected by mask, then pulse SCK
+#define SPI_WRITE_BIT(OutByte, mask) do { \
+  if ((OutByte) & (uint8_t)(mask)) PC_ODR |= (uint8_t)0x08; \
+  else PC_ODR &= (uint8_t)(~0x08); \
+  PC_ODR |= (uint8_t)0x04; \
+  PC_ODR &= (uint8_t)(~0x04); } while (0)
+
+// Sample one bit into InByte at the position selected by mask, then
+// pulse SCK so the ENC28J60 presents the next bit. InByte must be
+// cleared before the first bit is collected.
+#define SPI_READ_BIT(InByte, mask) do { \
+  if (PC_IDR & (uint8_t)0x10) InByte |= (uint8_t)(mask); \
+  PC_ODR |= (uint8_t)0x04; \
+  PC_ODR &= (uint8_t)(~0x04); } while (0)
+
+// MSB is sent first
+#define SPI_WRITE_BYTE(OutByte) do { \
+  SPI_WRITE_BIT(OutByte, 0x80); \
+  SPI_WRITE_BIT(OutByte, 0x40); \
+  SPI_WRITE_BIT(OutByte, 0x20); \
+  SPI_WRITE_BIT(OutByte, 0x10); \
+  SPI_WRITE_BIT(OutByte, 0x08); \
+  SPI_WRITE_BIT(OutByte, 0x04); \
+  SPI_WRITE_BIT(OutByte, 0x02); \
+  SPI_WRITE_BIT(OutByte, 0x01); } while (0)
+
+// MSB is received first
+#define SPI_READ_BYTE(InByte) do { \
+  InByte = 0; \
+  SPI_READ_BIT(InByte, 0x80); \
+  SPI_READ_BIT(InByte, 0x40); \
+  SPI_READ_BIT(InByte, 0x20); \
+  SPI_READ_BIT(InByte, 0x10); \
+  SPI_READ_BIT(InByte, 0x08); \
+  SPI_READ_BIT(InByte, 0x04); \
+  SPI_READ_BIT(InByte, 0x02); \
+  SPI_READ_BIT(InByte, 0x01); } while (0)
 
 
 void SpiWriteByte(uint8_t nByte)
 {
   // nByte is the data to be sent
-  // MSB is sent first
-  uint8_t bitnum = (uint8_t)0x80;                // Point at MSB
-  while(bitnum != 0) {
-    if (nByte & bitnum) PC_ODR |= (uint8_t)0x08; // If bit is 1 then 
-                                                 // SPI SO (ENC28J60 SI) high
-    else PC_ODR &= (uint8_t)(~0x08);             // else SPI SO low
-    
-    nop();
-    PC_ODR |= (uint8_t)0x04;                     // SCK high
-    nop();
-    PC_ODR &= (uint8_t)(~0x04);                  // SCK low
-
-    bitnum = (uint8_t)(bitnum >> 1);             // Shift bitnum right one place
-                                                 // Once bitnum has shifted to equal 0
-						 // we know all 8 bits have been sent
-  }
+  SPI_WRITE_BYTE(nByte);
   PC_ODR &= (uint8_t)(~0x08);                    // SPI SO low on exit
 }
 
 
 void SpiWriteChunk(const uint8_t* pChunk, uint16_t nBytes)
 {
-  uint8_t bitnum;
+  // Bulk path: the byte body is expanded in place so there is no call
+  // overhead per byte, and SO is only returned low once at the end.
   uint8_t OutByte;
 
   while (nBytes--) {
-    bitnum = (uint8_t)0x80;                          // Point at MSB
     OutByte = *pChunk++;
-
-    while(bitnum != 0) {
-      if (OutByte & bitnum) PC_ODR |= (uint8_t)0x08; // If bit is 1 then
-                                                     // SPI SO (ENC28J60 SI) high
-      else PC_ODR &= (uint8_t)(~0x08);               // else SPI SO low
-    
-      nop();
-      PC_ODR |= (uint8_t)0x04;                       // SCK high
-      nop();
-      PC_ODR &= (uint8_t)(~0x04);                    // SCK low
-
-      bitnum = (uint8_t)(bitnum >> 1);               // Shift bitnum right one place
-                                                     // Once bitnum has shifted to equal 0
-                                                     // we know all 8 bits have been sent
-    }
+    SPI_WRITE_BYTE(OutByte);
   }
-  PC_ODR &= (uint8_t)(~0x08);                        // SPI SO low on exit
+  PC_ODR &= (uint8_t)(~0x08);                    // SPI SO low on exit
 }
 
 
@@ -155,23 +232,9 @@ uint8_t SpiReadByte(void)
   // Reading a byte works by sending a dummy byte. The ENC28J60 will
   // ignore the dummy byte, and the clocks used to send the dummy byte
   // are used to transfer the read byte.
-  // MSB is received first
-  uint8_t bitnum = (uint8_t)0x80;                 // Point at MSB
-  uint8_t InByte = 0;
-  while(bitnum != 0) {
-    // Read SI and set appropriate bit in InByte
-    // Data is already there to be read due to previous command write
-    if (PC_IDR & (uint8_t)0x10) InByte |= bitnum; // SPI incoming bit = 1
-    else InByte &= (uint8_t)(~bitnum);            // SPI incoming bit = 0
-    
-    PC_ODR |= (uint8_t)0x04;                      // SCK high
-    nop();
-    PC_ODR &= (uint8_t)(~0x04);                   // SCK low
-
-    bitnum = (uint8_t)(bitnum >> 1);              // Shift bitnum right one place
-                                                  // Once bitnum has shifted to equal 0
-						  // we know all 8 bits have been collected
-  }
+  // Data is already there to be read due to previous command write.
+  uint8_t InByte;
+  SPI_READ_BYTE(InByte);
   return InByte;
 }
 
@@ -181,31 +244,120 @@ void SpiReadChunk(uint8_t* pChunk, uint16_t nBytes)
   // Reading data works by sending dummy bytes. The ENC28J60 will
   // ignore the dummy bytes, and the clocks used to send the dummy bytes
   // are used to collect the read bytes.
-  // MSB is received first
-  uint8_t bitnum;
+  // Bulk path: the byte body is expanded in place so there is no call
+  // overhead per byte.
   uint8_t InByte;
 
-  PC_ODR &= (uint8_t)(~0x08);                        // SO low
+  PC_ODR &= (uint8_t)(~0x08);                    // SO low
 
   while (nBytes--) {
-    bitnum = (uint8_t)0x80;                          // Point at MSB
-    InByte = 0;
-    while(bitnum != 0) {
-      // Read SI and set appropriate bit in InByte
-      // Data is already there to be read due to previous command write
-      // or byte read
-      if (PC_IDR & (uint8_t)0x10) InByte |= bitnum;  // SPI incoming bit = 1
-      else InByte &= (uint8_t)(~bitnum);             // SPI incoming bit = 0
-    
-      PC_ODR |= (uint8_t)0x04;                       // SCK high
-      nop();
-      PC_ODR &= (uint8_t)(~0x04);                    // SCK low
-
-      bitnum = (uint8_t)(bitnum >> 1);               // Shift bitnum right one place
-                                                     // Once bitnum has shifted to equal 0
-						     // we know all 8 bits have been collected
-    }
-  *pChunk++ = InByte;                                // Save byte in the buffer
+    SPI_READ_BYTE(InByte);
+    *pChunk++ = InByte;                          // Save byte in the buffer
   }
 }
+#endif /* SPI_SUPPORT == 1 */
+
+
+#if SPI_SUPPORT == 2
+// Hardware SPI transport. Each byte is written to SPI_DR and the byte
+// clocked in at the same time is collected from SPI_DR. Every transfer
+// is complete (RXNE seen) before the function returns so the caller can
+// raise -CS immediately afterward.
+
+void SpiWriteByte(uint8_t nByte)
+{
+  while (!(SPI_SR & SPI_SR_TXE));  // Wait for transmit buffer empty
+  SPI_DR = nByte;
+  while (!(SPI_SR & SPI_SR_RXNE)); // Wait for the byte to be clocked out
+  (void)SPI_DR;                    // Discard the byte clocked in
+}
+
 
+void SpiWriteChunk(const uint8_t* pChunk, uint16_t nBytes)
+{
+  // Bulk path: the next byte is loaded into the transmit buffer while
+  // the current byte is being shifted out so SCK runs without gaps.
+  if (nBytes == 0) return;
+  SPI_DR = *pChunk++;
+  while (--nBytes) {
+    while (!(SPI_SR & SPI_SR_TXE));
+    SPI_DR = *pChunk++;
+    while (!(SPI_SR & SPI_SR_RXNE));
+    (void)SPI_DR;
+  }
+  while (!(SPI_SR & SPI_SR_RXNE));
+  (void)SPI_DR;
+}
+
+
+uint8_t SpiReadByte(void)
+{
+  // Reading a byte works by sending a dummy byte. The ENC28J60 will
+  // ignore the dummy byte, and the clocks used to send the dummy byte
+  // are used to transfer the read byte.
+  while (!(SPI_SR & SPI_SR_TXE));
+  SPI_DR = (uint8_t)0x00;
+  while (!(SPI_SR & SPI_SR_RXNE));
+  return SPI_DR;
+}
+
+
+void SpiReadChunk(uint8_t* pChunk, uint16_t nBytes)
+{
+  // Bulk path: the next dummy byte is queued while the current byte is
+  // being received so SCK runs without gaps.
+  if (nBytes == 0) return;
+  SPI_DR = (uint8_t)0x00;
+  while (--nBytes) {
+    while (!(SPI_SR & SPI_SR_TXE));
+    SPI_DR = (uint8_t)0x00;
+    while (!(SPI_SR & SPI_SR_RXNE));
+    *pChunk++ = SPI_DR;
+  }
+  while (!(SPI_SR & SPI_SR_RXNE));
+  *pChunk = SPI_DR;
+}
+#endif /* SPI_SUPPORT == 2 */
+
+
+#if SPI_SUPPORT == 3
+// Host mock transport, for running the ENC28J60 driver in a Linux test.
+// Nothing is driven here. Every -CS edge and every byte is handed to the
+// test program, which models the ENC28J60 and supplies the byte clocked
+// back (see tools/enc28j60_test.c).
+
+void SpiSelect(void)
+{
+  SpiMockSelect(1);
+}
+
+
+void SpiDeselect(void)
+{
+  SpiMockSelect(0);
+}
+
+
+void SpiWriteByte(uint8_t nByte)
+{
+  SpiMockTransfer(nByte);
+}
+
+
+void SpiWriteChunk(const uint8_t* pChunk, uint16_t nBytes)
+{
+  while (nBytes--) SpiMockTransfer(*pChunk++);
+}
+
+
+uint8_t SpiReadByte(void)
+{
+  return SpiMockTransfer(0);
+}
+
+
+void SpiReadChunk(uint8_t* pChunk, uint16_t nBytes)
+{
+  while (nBytes--) *pChunk++ = SpiMockTransfer(0);
+}
+#endif /* SPI_SUPPORT == 3 */
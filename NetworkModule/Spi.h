@@ -51,9 +51,15 @@
 #include <stdint.h>
 
 void spi_init(void);
+void SpiSelect(void);
+void SpiDeselect(void);
 void SpiWriteByte(uint8_t nByte);
 void SpiWriteChunk(const uint8_t* pChunk, uint16_t nBytes);
 uint8_t SpiReadByte(void);
 void SpiReadChunk(uint8_t* pChunk, uint16_t nBytes);
 
+// Provided by the host test program when SPI_SUPPORT == 3
+void SpiMockSelect(uint8_t nSelect);
+uint8_t SpiMockTransfer(uint8_t nByte);
+
 #endif /*SPI_H_*/
@@ -49,6 +49,7 @@
 #include "uip.h"
 #include "gpio.h"
 #include "main.h"
+#include "Enc28j60.h"
 
 #include "stdlib.h"
 #include "string.h"
@@ -67,6 +68,7 @@
 #define STATE_SENDHEADER	11	// Next we send him the HTTP header
 #define STATE_SENDDATA		12	// ... followed by data
 #define STATE_PARSEGET		13	// We are currently parsing the client's GET-request
+#define STATE_SENDCACHE		14	// Sending data from the page cache
 
 #define PARSE_CMD		0       // Parsing the command byte in a POST
 #define PARSE_NUM10		1       // Parsing the most sig digit of POST cmd
@@ -76,8 +78,35 @@
 #define PARSE_DELIM		5       // Parsing the delimiter of a POST cmd
 #define PARSE_SLASH1		6       // Parsing the slash of a GET cmd
 
+#define HTTP_CHUNK_HEAD		5	// Chunk length in 3 hex digits and CRLF
+#define HTTP_CHUNK_FRAMING	12	// Chunk head, CRLF and closing "0\r\n\r\n"
+
 uint8_t current_webpage;                // Tracks the web page that is currently displayed
 
+#if UIP_ARCH_CHKSUM == 0
+// One's complement sum of the bytes written by the last CopyHttpData call,
+// handed to uip_send_chksum so uip only has to sum the TCP/IP headers.
+uint16_t nDataChksum;
+
+// Adds byte b at position n of the TCP payload to the one's complement
+// sum s. Even positions are the high byte of a 16 bit word.
+#define CHKSUM_ADD(s, b, n) { \
+  uint16_t t = ((n) & 1) ? (uint16_t)(b) : (uint16_t)((uint16_t)(b) << 8); \
+  s += t; \
+  if (s < t) s++; }
+#endif /* UIP_ARCH_CHKSUM == 0 */
+
+#if PAGE_CACHE_SUPPORT == 1
+// Page cache. pCachePage is the template of the page rendered into the
+// ENC28J60 page cache (0 = none) and nCacheLen its rendered length. The
+// cache is only valid for the IO states it was rendered with.
+const char* pCachePage;
+uint16_t nCacheLen;
+uint8_t nCacheIO_16to9;
+uint8_t nCacheIO_8to1;
+uint8_t nCacheInvert;
+#endif /* PAGE_CACHE_SUPPORT == 1 */
+
 extern uint16_t Port_Httpd;             // Port number in use
 
 extern uint8_t IO_16to9;                // State of upper 8 IO
@@ -108,6 +137,9 @@ extern uint8_t Pending_uip_ethaddr4;    //
 extern uint8_t Pending_uip_ethaddr5;    //
 extern uint8_t Pending_uip_ethaddr6;    //
 
+extern uint8_t enc28j60_config;         // ENC28J60 duplex mode and buffer partition
+extern uint8_t Pending_enc28j60_config; // Temp storage for new ENC28J60 config
+
 // The variables stored in EEPROM can only be accessed within the
 // file in which they are declared. But I need to display them from
 // within the httpd.c file. So additional variables are needed to
@@ -439,9 +471,10 @@ static const char g_HtmlPageDefault[] =
 // that a form submittal always returns the exact same amount of information even if
 // no fields were changed on the form.
 //
-// The form contained in the g_HtmlPageAddress webpage will generate 19 data replies.
+// The form contained in the g_HtmlPageAddress webpage will generate 21 data replies.
 // BUT NOTE THAT 12 OF THE REPLIES HAVE 3 BYTES EACH, ONE OF THE REPLIES HAS 5 BYTES,
-// AND 6 OF THE REPLIES HAVE 2 BYTES. These replies need to be parsed to extract the
+// 6 OF THE REPLIES HAVE 2 BYTES, AND 2 OF THE REPLIES HAVE 1 BYTE. These replies
+// need to be parsed to extract the
 // data from them. We need to stop parsing the reply POST data after all update bytes
 // are parsed. The formula for determining the stop value is as follows:
 //
@@ -463,13 +496,20 @@ static const char g_HtmlPageDefault[] =
 //     Followed by an equal sign in 1 byte
 //     Followed by a state value in 2 bytes (for 6 of the replies)
 //     Followed by a parse delimiter in 1 byte
+//   PLUS
+//     A ParseCmd (a "j" in this case) in 1 byte
+//     Followed by the ParseNum in 2 bytes
+//     Followed by an equal sign in 1 byte
+//     Followed by a state value in 1 byte (for 2 of the replies)
+//     Followed by a parse delimiter in 1 byte
 // THUS for 12 of the replies there are 8 bytes per reply
 // For 1 of the replies there are 10 bytes in the reply
 // For 6 of the replies there are 7 bytes per replye
-// The formula in this case is PARSEBYTES = (12 x 8) + (1 x 10) + (6 x 7) - 1
-//                             PARSEBYTES =  96      +  10      +  42     - 1 = 147
+// For 2 of the replies there are 6 bytes per reply
+// The formula in this case is PARSEBYTES = (12 x 8) + (1 x 10) + (6 x 7) + (2 x 6) - 1
+//                             PARSEBYTES =  96      +  10      +  42     +  12     - 1 = 159
 #define WEBPAGE_ADDRESS		1
-#define PARSEBYTES_ADDRESS	147
+#define PARSEBYTES_ADDRESS	159
 static const char g_HtmlPageAddress[] =
   "<!DOCTYPE html>"
   "<html lang='en-US'>"
@@ -511,6 +551,10 @@ static const char g_HtmlPageAddress[] =
                                      "<td><input type='text' name='d04' class='t3' value='%d04' pattern='[0-9a-f]{2}' title='Enter 00 to ff' maxlength='2'></td>"
                                      "<td><input type='text' name='d05' class='t3' value='%d05' pattern='[0-9a-f]{2}' title='Enter 00 to ff' maxlength='2'></td></tr>"
   "</table>"
+  "<table>"
+  "<tr><td class='t1'>TX Buffer KB</td><td><input type='text' name='j00' class='t3' value='%j00' pattern='[1-4]' title='Enter 1 to 4 (the rest of 8KB is RX buffer)' maxlength='1'></td></tr>"
+  "<tr><td class='t1'>Full Duplex</td><td><input type='text' name='j01' class='t3' value='%j01' pattern='[0-1]' title='Enter 0 for half duplex, 1 for full duplex' maxlength='1'></td></tr>"
+  "</table>"
   "<button type='submit' title='Saves your changes then restarts the Network Module'>Save</button>"
   "<button type='reset' title='Un-does any changes that have not been saved'>Undo All</button>"
   "</form>"
@@ -750,6 +794,16 @@ static const char g_HtmlPageStats[] =
   "<tr><td class='t1'>%e19xxxxxxxxxx</td><td class='t2'>Retransmitted TCP segments</td></tr>"
   "<tr><td class='t1'>%e20xxxxxxxxxx</td><td class='t2'>Dropped SYNs due to too few connections avaliable</td></tr>"
   "<tr><td class='t1'>%e21xxxxxxxxxx</td><td class='t2'>SYNs for closed ports, triggering a RST</td></tr>"
+  "<tr><td class='t1'>%e22xxxxxxxxxx</td><td class='t2'>Received frames skipped (not ARP or IP for this device)</td></tr>"
+  "<tr><td class='t1'>%e23xxxxxxxxxx</td><td class='t2'>Received frames dropped for being too large</td></tr>"
+  "<tr><td class='t1'>%e24xxxxxxxxxx</td><td class='t2'>Received frames dropped for a receive error</td></tr>"
+  "<tr><td class='t1'>%e25xxxxxxxxxx</td><td class='t2'>Receive buffer overflows</td></tr>"
+  "<tr><td class='t1'>%e26xxxxxxxxxx</td><td class='t2'>Receive logic resets</td></tr>"
+  "<tr><td class='t1'>%e27xxxxxxxxxx</td><td class='t2'>ARP table hits</td></tr>"
+  "<tr><td class='t1'>%e28xxxxxxxxxx</td><td class='t2'>ARP table misses (ARP request sent)</td></tr>"
+  "<tr><td class='t1'>%e29xxxxxxxxxx</td><td class='t2'>ARP table entries evicted</td></tr>"
+  "<tr><td class='t1'>%e30xxxxxxxxxx</td><td class='t2'>HTTP requests answered</td></tr>"
+  "<tr><td class='t1'>%e31xxxxxxxxxx</td><td class='t2'>HTTP requests deferred (sent while a response was under way)</td></tr>"
   "</table>"
   "<form style='display: inline' action='%x00http://192.168.001.004:08080/60' method='GET'><button title='Go to IO Control Page'>IO Control</button></form>"
   "<form style='display: inline' action='%x00http://192.168.001.004:08080/67' method='GET'><button title='Clear Statistics'>Clear Statistics</button></form>"
@@ -929,7 +983,7 @@ uint8_t two_alpha_to_uint(uint8_t alpha1, uint8_t alpha2)
 }
 
 
-static uint16_t CopyHttpHeader(uint8_t* pBuffer, uint32_t nDataLen)
+static uint16_t CopyHttpHeader(uint8_t* pBuffer, uint32_t nDataLen, uint8_t nKeepAlive)
 {
   uint16_t nBytes;
 
@@ -938,12 +992,22 @@ static uint16_t CopyHttpHeader(uint8_t* pBuffer, uint32_t nDataLen)
   nBytes += CopyStringP(&pBuffer, (const char *)("HTTP/1.1 200 OK"));
   nBytes += CopyStringP(&pBuffer, (const char *)("\r\n"));
 
-  nBytes += CopyStringP(&pBuffer, (const char *)("Content-Length:"));
-  nBytes += CopyValue(&pBuffer, nDataLen);
-  nBytes += CopyStringP(&pBuffer, (const char *)("\r\n"));
+  // A page of unknown length (nDataLen 0) is sent in chunks on a kept alive
+  // connection, otherwise closing the connection marks its end. Rendering
+  // makes a page shorter than its template, so the template length can't
+  // be given as Content-Length.
+  if (nDataLen == 0) {
+    if (nKeepAlive) nBytes += CopyStringP(&pBuffer, (const char *)("Transfer-Encoding:chunked\r\n"));
+  }
+  else {
+    nBytes += CopyStringP(&pBuffer, (const char *)("Content-Length:"));
+    nBytes += CopyValue(&pBuffer, nDataLen);
+    nBytes += CopyStringP(&pBuffer, (const char *)("\r\n"));
+  }
 
   nBytes += CopyStringP(&pBuffer, (const char *)("Content-Type:text/html\r\n"));
-  nBytes += CopyStringP(&pBuffer, (const char *)("Connection:close\r\n"));
+  if (nKeepAlive) nBytes += CopyStringP(&pBuffer, (const char *)("Connection:keep-alive\r\n"));
+  else nBytes += CopyStringP(&pBuffer, (const char *)("Connection:close\r\n"));
   nBytes += CopyStringP(&pBuffer, (const char *)("\r\n"));
 
   return nBytes;
@@ -966,8 +1030,15 @@ static uint16_t CopyHttpData(uint8_t* pBuffer, const char** ppData, uint16_t* pD
   uint8_t temp;
   uint8_t i;
   uint8_t advanceptrs;
+#if UIP_ARCH_CHKSUM == 0
+  uint8_t* pField;
+  uint16_t nField;
+#endif /* UIP_ARCH_CHKSUM == 0 */
 
   nBytes = 0;
+#if UIP_ARCH_CHKSUM == 0
+  nDataChksum = 0;
+#endif /* UIP_ARCH_CHKSUM == 0 */
 
   // The input value "nMaxBytes" provided by the calling routine is based on the
   // MSS (Maximum Segment Size). MSS indicates the maximum number of bytes that the
@@ -1053,6 +1124,8 @@ static uint16_t CopyHttpData(uint8_t* pBuffer, const char** ppData, uint16_t* pD
       // %f - Relays states displayed in simplified form. Output only.
       // %g - "ON" radio button to control the Invert function for GPIO pins
       // %h - "OFF" radio button to control the Invert function for GPIO pins
+      // %j - ENC28J60 TX buffer size in KB (j00) and duplex mode (j01). Input
+      //      and output.
       // %x - Indicates the start of the http field that identifies the IP Address
       //      and Port Number for the "Next Page". Output only.
       // %z - A bogus variable inserted at the end of the form data to make sure
@@ -1061,6 +1134,10 @@ static uint16_t CopyHttpData(uint8_t* pBuffer, const char** ppData, uint16_t* pD
       //      itself is never used.
       
       if (nByte == '%') {
+#if UIP_ARCH_CHKSUM == 0
+        pField = pBuffer;
+        nField = nBytes;
+#endif /* UIP_ARCH_CHKSUM == 0 */
         *ppData = *ppData + 1;
         *pDataLeft = *pDataLeft - 1;
 
@@ -1282,6 +1359,16 @@ static uint16_t CopyHttpData(uint8_t* pBuffer, const char** ppData, uint16_t* pD
 	  // uip_stat.tcp.rexmit    Number of retransmitted TCP segments.
 	  // uip_stat.tcp.syndrop   Number of dropped SYNs due to too few connections avaliable.
 	  // uip_stat.tcp.synrst    Number of SYNs for closed ports, triggering a RST.
+	  // uip_stat.eth.skipped   Number of received frames discarded after reading only the header.
+	  // uip_stat.eth.oversize  Number of received frames dropped for exceeding ENC28J60_MAXFRAME.
+	  // uip_stat.eth.rxerror   Number of received frames dropped for a receive error.
+	  // uip_stat.eth.overflow  Number of times frames were lost because the RX buffer was full.
+	  // uip_stat.eth.rxreset   Number of RX resets after a corrupt receive header.
+	  // uip_stat.arp.hit       Number of outgoing IP packets that found their ARP table entry.
+	  // uip_stat.arp.miss      Number of outgoing IP packets that needed an ARP request.
+	  // uip_stat.arp.evict     Number of ARP table entries thrown away to make room.
+	  // uip_stat.http.requests Number of HTTP requests answered.
+	  // uip_stat.http.deferred Number of HTTP requests refused while a response was being sent.
 	  
           switch (nParsedNum)
 	  {
@@ -1308,6 +1395,16 @@ static uint16_t CopyHttpData(uint8_t* pBuffer, const char** ppData, uint16_t* pD
 	    case 19: emb_itoa(uip_stat.tcp.rexmit,   OctetArray, 10, 10); break;
 	    case 20: emb_itoa(uip_stat.tcp.syndrop,  OctetArray, 10, 10); break;
 	    case 21: emb_itoa(uip_stat.tcp.synrst,   OctetArray, 10, 10); break;
+	    case 22: emb_itoa(uip_stat.eth.skipped,  OctetArray, 10, 10); break;
+	    case 23: emb_itoa(uip_stat.eth.oversize, OctetArray, 10, 10); break;
+	    case 24: emb_itoa(uip_stat.eth.rxerror,  OctetArray, 10, 10); break;
+	    case 25: emb_itoa(uip_stat.eth.overflow, OctetArray, 10, 10); break;
+	    case 26: emb_itoa(uip_stat.eth.rxreset,  OctetArray, 10, 10); break;
+	    case 27: emb_itoa(uip_stat.arp.hit,      OctetArray, 10, 10); break;
+	    case 28: emb_itoa(uip_stat.arp.miss,     OctetArray, 10, 10); break;
+	    case 29: emb_itoa(uip_stat.arp.evict,    OctetArray, 10, 10); break;
+	    case 30: emb_itoa(uip_stat.http.requests, OctetArray, 10, 10); break;
+	    case 31: emb_itoa(uip_stat.http.deferred, OctetArray, 10, 10); break;
 	    default: emb_itoa(0,                     OctetArray, 10, 10); break;
 	  }
 
@@ -1366,6 +1463,15 @@ static uint16_t CopyHttpData(uint8_t* pBuffer, const char** ppData, uint16_t* pD
 	  }
 	}
 
+        else if (nParsedMode == 'j') {
+	  // This is the ENC28J60 configuration (1 character). j00 is the number
+	  // of 1KB TX slots and j01 is 1 for full duplex, 0 for half duplex.
+	  if (nParsedNum == 0) *pBuffer = (uint8_t)('0' + (enc28j60_config & ENC28J60_CFG_TXSLOTS));
+	  else *pBuffer = (uint8_t)((enc28j60_config & ENC28J60_CFG_FULDPX) ? '1' : '0');
+          pBuffer++;
+          nBytes++;
+	}
+
         else if (nParsedMode == 'x') {
 	  // This is the http field containing the "Next Page" link. It is always in the
 	  // form "http://192.168.001.004:08080/60". This routine will output the
@@ -1465,9 +1571,22 @@ static uint16_t CopyHttpData(uint8_t* pBuffer, const char** ppData, uint16_t* pD
           *ppData = *ppData + 28;
           *pDataLeft = *pDataLeft - 28;
 	}
+#if UIP_ARCH_CHKSUM == 0
+        // Add whatever was inserted for the field to the checksum. Fields
+        // are short, so this re-reads only a few bytes per field.
+        while (pField < pBuffer) {
+          CHKSUM_ADD(nDataChksum, *pField, nField);
+          pField++;
+          nField++;
+        }
+#endif /* UIP_ARCH_CHKSUM == 0 */
       }
       else {
         *pBuffer = nByte;
+#if UIP_ARCH_CHKSUM == 0
+        // Plain template bytes are summed on the way through
+        CHKSUM_ADD(nDataChksum, nByte, nBytes);
+#endif /* UIP_ARCH_CHKSUM == 0 */
         *ppData = *ppData + 1;
         *pDataLeft = *pDataLeft - 1;
         pBuffer++;
@@ -1485,12 +1604,267 @@ void HttpDInit()
   //Start listening on our port
   uip_listen(htons(Port_Httpd));
   current_webpage = WEBPAGE_DEFAULT;
+#if PAGE_CACHE_SUPPORT == 1
+  pCachePage = 0;
+#endif /* PAGE_CACHE_SUPPORT == 1 */
+}
+
+
+#if PAGE_CACHE_SUPPORT == 1
+static uint8_t HttpDCacheLookup(struct tHttpD* pSocket)
+{
+  // Makes sure the page the socket is about to send is in the page cache.
+  // Returns 1 if it is (rendering it first if needed), 0 if the page has
+  // to be rendered on the fly.
+  const char* pData;
+  uint16_t nDataLeft;
+  uint16_t nLen;
+  uint16_t nBytes;
+  uint8_t i;
+
+#if UIP_STATISTICS == 1
+  // Statistics change all the time
+  if (pSocket->pData == g_HtmlPageStats) return 0;
+#endif /* UIP_STATISTICS == 1 */
+
+  if (pCachePage == pSocket->pData
+   && nCacheIO_16to9 == IO_16to9
+   && nCacheIO_8to1 == IO_8to1
+   && nCacheInvert == invert_output) return 1;
+
+  // Rendering never makes a page longer than its template
+  if (pSocket->nDataLeft > Enc28j60CacheSize()) return 0;
+
+  // Don't overwrite the cache while another connection is sending from it
+  for (i = 0; i < UIP_CONNS; i++) {
+    if ((uip_conns[i].tcpstateflags & UIP_TS_MASK) == UIP_ESTABLISHED
+     && uip_conns[i].appstate.HttpDSocket.nState == STATE_SENDCACHE) return 0;
+  }
+
+  // Render the whole page into the cache, using uip_appdata as scratch
+  // buffer. The request in it has already been parsed.
+  pData = (const char*)pSocket->pData;
+  nDataLeft = pSocket->nDataLeft;
+  nLen = 0;
+  pCachePage = 0;
+  while ((nBytes = CopyHttpData(uip_appdata, &pData, &nDataLeft, uip_mss())) != 0) {
+    if (nLen + nBytes > Enc28j60CacheSize()) return 0;
+    Enc28j60CacheWrite(nLen, (uint8_t*)uip_appdata, nBytes);
+    nLen += nBytes;
+  }
+
+  pCachePage = (const char*)pSocket->pData;
+  nCacheLen = nLen;
+  nCacheIO_16to9 = IO_16to9;
+  nCacheIO_8to1 = IO_8to1;
+  nCacheInvert = invert_output;
+  return 1;
+}
+
+
+static uint16_t CopyHttpCache(struct tHttpD* pSocket, uint16_t nMaxBytes)
+{
+  // Attaches up to nMaxBytes of the cached page to the outgoing frame,
+  // behind the HTTP header if there is one in uip_appdata. The ENC28J60
+  // DMA copies the data into the frame, so uip_appdata is left as is.
+  uint16_t nBytes;
+
+  nBytes = nMaxBytes;
+  if (nBytes > pSocket->nDataLeft) nBytes = pSocket->nDataLeft;
+  if (nBytes != 0) Enc28j60CacheAttach(nCacheLen - pSocket->nDataLeft, nBytes, pSocket->nHeader);
+  pSocket->nDataLeft -= nBytes;
+  return nBytes;
+}
+#endif /* PAGE_CACHE_SUPPORT == 1 */
+
+
+static void HttpDSocketInit(struct tHttpD* pSocket)
+{
+  // Prepares the socket for the next request. Unless the request asks for
+  // another page the current web page is sent.
+  if (current_webpage == WEBPAGE_DEFAULT) {
+    pSocket->pData = g_HtmlPageDefault;
+    pSocket->nDataLeft = sizeof(g_HtmlPageDefault)-1;
+    // nDataLeft extracted above is used when we get around to calling CopyHttpData
+    // in state STATE_SENDDATA
+  }
+  else if (current_webpage == WEBPAGE_ADDRESS) {
+    pSocket->pData = g_HtmlPageAddress;
+    pSocket->nDataLeft = sizeof(g_HtmlPageAddress)-1;
+  }
+
+#if HELP_SUPPORT == 1
+  else if (current_webpage == WEBPAGE_HELP) {
+    pSocket->pData = g_HtmlPageHelp;
+    pSocket->nDataLeft = sizeof(g_HtmlPageHelp)-1;
+  }
+  else if (current_webpage == WEBPAGE_HELP2) {
+    pSocket->pData = g_HtmlPageHelp2;
+    pSocket->nDataLeft = sizeof(g_HtmlPageHelp2)-1;
+  }
+#endif /* HELP_SUPPORT == 1 */
+
+#if UIP_STATISTICS == 1
+  else if (current_webpage == WEBPAGE_STATS) {
+    pSocket->pData = g_HtmlPageStats;
+    pSocket->nDataLeft = sizeof(g_HtmlPageStats)-1;
+  }
+#endif /* UIP_STATISTICS == 1 */
+  else if (current_webpage == WEBPAGE_RSTATE) {
+    pSocket->pData = g_HtmlPageRstate;
+    pSocket->nDataLeft = sizeof(g_HtmlPageRstate)-1;
+  }
+  pSocket->nNewlines = 0;
+  pSocket->nState = STATE_CONNECTED;
+  pSocket->nPrevBytes = 0xFFFF;
+  pSocket->nKeepAlive = 0;
+  pSocket->nIdle = 0;
 }
 
 
+#if HTTP_KEEPALIVE_SUPPORT == 1
+static uint16_t HttpDChunk(uint8_t* pChunk, uint16_t nBytes, uint8_t nLast)
+{
+  // Frames the nBytes of page data that follow the HTTP_CHUNK_HEAD bytes
+  // at pChunk as one chunk: the length in 3 hex digits and CRLF in front,
+  // CRLF behind, and after the last data the closing zero length chunk.
+  // Returns the length of the framed chunk.
+  uint8_t* pBuffer;
+
+  emb_itoa(nBytes, OctetArray, 16, 3);
+  pChunk[0] = OctetArray[0];
+  pChunk[1] = OctetArray[1];
+  pChunk[2] = OctetArray[2];
+  pChunk[3] = '\r';
+  pChunk[4] = '\n';
+  pBuffer = pChunk + HTTP_CHUNK_HEAD + nBytes;
+  nBytes += HTTP_CHUNK_HEAD;
+  nBytes += CopyStringP(&pBuffer, (const char *)("\r\n"));
+  if (nLast) nBytes += CopyStringP(&pBuffer, (const char *)("0\r\n\r\n"));
+  return nBytes;
+}
+#endif /* HTTP_KEEPALIVE_SUPPORT == 1 */
+
+
+static uint16_t HttpDSendSegment(struct tHttpD* pSocket)
+{
+  // Sends the next segment of the page in STATE_SENDDATA or
+  // STATE_SENDCACHE. The first segment (nPrevBytes == 0xFFFF) starts with
+  // the HTTP header followed by as much data as fits, so the page does not
+  // wait a round trip for the header to be acknowledged. nPrevBytes and
+  // nHeader record what the segment holds for a retransmission. Returns
+  // the segment length, 0 once the whole page has been sent.
+  uint16_t nMaxBytes;
+  uint16_t nBytes;
+  uint8_t* pBuffer;
+  uint8_t nChunked;
+#if UIP_ARCH_CHKSUM == 0
+  uint16_t nData;
+  uint16_t i;
+#endif /* UIP_ARCH_CHKSUM == 0 */
+
+  // Once the whole page is out nothing is built, so nPrevBytes and nHeader
+  // still describe the last segment, which may be in flight
+  if (pSocket->nPrevBytes != 0xFFFF && pSocket->nDataLeft == 0) return 0;
+
+  // A kept alive rendered page is sent in chunks
+  nChunked = (uint8_t)(pSocket->nKeepAlive && pSocket->nState == STATE_SENDDATA);
+
+  pSocket->nHeader = 0;
+  if (pSocket->nPrevBytes == 0xFFFF) {
+    pSocket->nHeader = (uint8_t)CopyHttpHeader(uip_appdata, pSocket->nState == STATE_SENDDATA ? 0 : pSocket->nDataLeft, pSocket->nKeepAlive);
+  }
+
+  // Segments are kept to the size CopyHttpData limits itself to, header
+  // included
+  nMaxBytes = uip_mss();
+  if (nMaxBytes > 400) nMaxBytes = 400;
+  if (nMaxBytes > pSocket->nHeader) nMaxBytes -= pSocket->nHeader;
+  else nMaxBytes = 0;
+
+#if PAGE_CACHE_SUPPORT == 1
+  if (pSocket->nState == STATE_SENDCACHE) {
+    pSocket->nPrevBytes = CopyHttpCache(pSocket, nMaxBytes);
+    nBytes = pSocket->nHeader + pSocket->nPrevBytes;
+    uip_send(uip_appdata, nBytes);
+    return nBytes;
+  }
+#endif /* PAGE_CACHE_SUPPORT == 1 */
+
+  pBuffer = (uint8_t*)uip_appdata + pSocket->nHeader;
+#if HTTP_KEEPALIVE_SUPPORT == 1
+  // Leave room for the chunk framing
+  if (nChunked) {
+    if (nMaxBytes > HTTP_CHUNK_FRAMING) nMaxBytes -= HTTP_CHUNK_FRAMING;
+    else nMaxBytes = 0;
+    pBuffer += HTTP_CHUNK_HEAD;
+  }
+#endif /* HTTP_KEEPALIVE_SUPPORT == 1 */
+
+  pSocket->nPrevBytes = pSocket->nDataLeft;
+  nBytes = CopyHttpData(pBuffer, &pSocket->pData, &pSocket->nDataLeft, nMaxBytes);
+  pSocket->nPrevBytes -= pSocket->nDataLeft;
+#if UIP_ARCH_CHKSUM == 0
+  nData = nBytes;
+#endif /* UIP_ARCH_CHKSUM == 0 */
+#if HTTP_KEEPALIVE_SUPPORT == 1
+  if (nChunked && nBytes != 0) {
+    nBytes = HttpDChunk(pBuffer - HTTP_CHUNK_HEAD, nBytes, (uint8_t)(pSocket->nDataLeft == 0));
+  }
+  else if (nChunked) pBuffer -= HTTP_CHUNK_HEAD;
+#endif /* HTTP_KEEPALIVE_SUPPORT == 1 */
+  nBytes += pSocket->nHeader;
+#if UIP_ARCH_CHKSUM == 0
+  // nDataChksum covers the page data only. Add the few bytes of HTTP header
+  // and chunk framing around it so uip still only sums the TCP/IP headers.
+  // Data that starts at an odd offset has the bytes of its sum swapped.
+  i = (uint16_t)(pBuffer - (uint8_t*)uip_appdata);
+  if (i & 1) nDataChksum = (uint16_t)((nDataChksum << 8) | (nDataChksum >> 8));
+  while (i != 0) {
+    i--;
+    CHKSUM_ADD(nDataChksum, ((uint8_t*)uip_appdata)[i], i);
+  }
+  for (i = (uint16_t)(pBuffer - (uint8_t*)uip_appdata) + nData; i < nBytes; i++) {
+    CHKSUM_ADD(nDataChksum, ((uint8_t*)uip_appdata)[i], i);
+  }
+#endif /* UIP_ARCH_CHKSUM == 0 */
+  uip_send_chksum(uip_appdata, nBytes, nDataChksum);
+  return nBytes;
+}
+
+
+#if HTTP_KEEPALIVE_SUPPORT == 1
+static uint8_t HttpDKeepAlive(uint8_t* pBuffer, uint16_t nBytes)
+{
+  // Looks at the rest of a GET request, starting within the request line.
+  // Returns 1 if the request line ends in HTTP/1.1 and "close" does not
+  // appear in the headers. A "close" found elsewhere only costs a new
+  // connection for the next request.
+  uint8_t i;
+
+  for (i = 0; nBytes != 0 && *pBuffer != '\r'; ) {
+    if (i < 3) i++;
+    pBuffer++;
+    nBytes--;
+  }
+  if (nBytes == 0 || i < 3 || pBuffer[-3] != '1' || pBuffer[-2] != '.' || pBuffer[-1] != '1') return 0;
+
+  while (nBytes >= 5) {
+    if ((pBuffer[0] | 0x20) == 'c'
+     && (pBuffer[1] | 0x20) == 'l'
+     && (pBuffer[2] | 0x20) == 'o'
+     && (pBuffer[3] | 0x20) == 's'
+     && (pBuffer[4] | 0x20) == 'e') return 0;
+    pBuffer++;
+    nBytes--;
+  }
+  return 1;
+}
+#endif /* HTTP_KEEPALIVE_SUPPORT == 1 */
+
+
 void HttpDCall(	uint8_t* pBuffer, uint16_t nBytes, struct tHttpD* pSocket)
 {
-  uint16_t nBufSize;
   uint8_t alpha_1;
   uint8_t alpha_2;
   uint8_t alpha_3;
@@ -1507,43 +1881,40 @@ void HttpDCall(	uint8_t* pBuffer, uint16_t nBytes, struct tHttpD* pSocket)
 
   if (uip_connected()) {
     //Initialize this connection
-    if (current_webpage == WEBPAGE_DEFAULT) {
-      pSocket->pData = g_HtmlPageDefault;
-      pSocket->nDataLeft = sizeof(g_HtmlPageDefault)-1;
-      // nDataLeft extracted above is used when we get around to calling CopyHttpData
-      // in state STATE_SENDDATA
-    }
-    else if (current_webpage == WEBPAGE_ADDRESS) {
-      pSocket->pData = g_HtmlPageAddress;
-      pSocket->nDataLeft = sizeof(g_HtmlPageAddress)-1;
-    }
-
-#if HELP_SUPPORT == 1
-    else if (current_webpage == WEBPAGE_HELP) {
-      pSocket->pData = g_HtmlPageHelp;
-      pSocket->nDataLeft = sizeof(g_HtmlPageHelp)-1;
-    }
-    else if (current_webpage == WEBPAGE_HELP2) {
-      pSocket->pData = g_HtmlPageHelp2;
-      pSocket->nDataLeft = sizeof(g_HtmlPageHelp2)-1;
+    HttpDSocketInit(pSocket);
+    pSocket->nRequests = 0;
+  }
+#if UIP_TCP_WINDOW > 1
+  // A poll while the page is being sent means there is room in the send
+  // window for another segment
+  else if (uip_newdata() || uip_acked()
+   || (uip_poll() && (pSocket->nState == STATE_SENDHEADER
+                   || pSocket->nState == STATE_SENDDATA
+                   || pSocket->nState == STATE_SENDCACHE))) {
+#else
+  else if (uip_newdata() || uip_acked()) {
+#endif /* UIP_TCP_WINDOW > 1 */
+#if HTTP_KEEPALIVE_SUPPORT == 1
+    // A kept alive response is complete once all of it is acknowledged.
+    // The next request may come with that ACK.
+    if (pSocket->nKeepAlive
+     && pSocket->nRequests < HTTP_KEEPALIVE_MAX
+     && (pSocket->nState == STATE_SENDDATA || pSocket->nState == STATE_SENDCACHE)
+     && pSocket->nDataLeft == 0
+     && !uip_outstanding(uip_conn)) {
+      HttpDSocketInit(pSocket);
     }
-#endif /* HELP_SUPPORT == 1 */
-
+#endif /* HTTP_KEEPALIVE_SUPPORT == 1 */
+    // A request that arrives while a response is still being sent can't
+    // be taken, there is no room to keep it. It is refused, so the client
+    // sends it again and it is answered once the response is complete.
+    if (uip_newdata()
+     && (pSocket->nState == STATE_SENDDATA || pSocket->nState == STATE_SENDCACHE)) {
+      uip_refuse();
 #if UIP_STATISTICS == 1
-    else if (current_webpage == WEBPAGE_STATS) {
-      pSocket->pData = g_HtmlPageStats;
-      pSocket->nDataLeft = sizeof(g_HtmlPageStats)-1;
-    }
+      uip_stat.http.deferred++;
 #endif /* UIP_STATISTICS == 1 */
-    else if (current_webpage == WEBPAGE_RSTATE) {
-      pSocket->pData = g_HtmlPageRstate;
-      pSocket->nDataLeft = sizeof(g_HtmlPageRstate)-1;
     }
-    pSocket->nNewlines = 0;
-    pSocket->nState = STATE_CONNECTED;
-    pSocket->nPrevBytes = 0xFFFF;
-  }
-  else if (uip_newdata() || uip_acked()) {
     if (pSocket->nState == STATE_CONNECTED) {
       if (nBytes == 0) return;
       if (*pBuffer == 'G') pSocket->nState = STATE_GET_G;
@@ -1617,6 +1988,10 @@ void HttpDCall(	uint8_t* pBuffer, uint16_t nBytes, struct tHttpD* pSocket)
           pSocket->ParseState = PARSE_CMD;
           // Start parsing
           pSocket->nState = STATE_PARSEPOST;
+#if PAGE_CACHE_SUPPORT == 1
+          // A POST may change anything shown on the pages
+          pCachePage = 0;
+#endif /* PAGE_CACHE_SUPPORT == 1 */
           break;
         }
       }
@@ -1654,7 +2029,8 @@ void HttpDCall(	uint8_t* pBuffer, uint16_t nBytes, struct tHttpD* pSocket)
 	      pSocket->ParseCmd == 'b' ||
 	      pSocket->ParseCmd == 'c' ||
 	      pSocket->ParseCmd == 'd' ||
-	      pSocket->ParseCmd == 'g') { }
+	      pSocket->ParseCmd == 'g' ||
+	      pSocket->ParseCmd == 'j') { }
 	  else { pSocket->ParseState = PARSE_DELIM; } // Something out of sync - escape
         }
         else if (pSocket->ParseState == PARSE_NUM10) {
@@ -1684,6 +2060,7 @@ void HttpDCall(	uint8_t* pBuffer, uint16_t nBytes, struct tHttpD* pSocket)
 	  // 'c' is submit data for the Port number
 	  // 'd' is submit data for the MAC
 	  // 'g' is submit data for the Invert Relay Control
+	  // 'j' is submit data for the ENC28J60 TX buffer size and duplex mode
 	  
           if (pSocket->ParseCmd == 'o') {
             // This code sets the new Pin state on a pin when user commanded via
@@ -1837,6 +2214,25 @@ void HttpDCall(	uint8_t* pBuffer, uint16_t nBytes, struct tHttpD* pSocket)
             pBuffer++;
           }
 	  
+	  else if (pSocket->ParseCmd == 'j') {
+            // This code updates the "pending" ENC28J60 configuration which will
+	    // then cause the main.c routines to restart the software. j00 is the
+	    // TX buffer size in KB ('1' to '4'), j01 the duplex mode ('0' or '1').
+	    // A TX buffer size out of range is ignored.
+	    if (pSocket->ParseNum == 0) {
+	      if ((uint8_t)(*pBuffer) >= '1' && (uint8_t)(*pBuffer) <= '0' + ENC28J60_TXSLOTS) {
+	        Pending_enc28j60_config &= (uint8_t)~ENC28J60_CFG_TXSLOTS;
+	        Pending_enc28j60_config |= (uint8_t)(*pBuffer - '0');
+	      }
+	    }
+	    else {
+	      if ((uint8_t)(*pBuffer) == '1') Pending_enc28j60_config |= ENC28J60_CFG_FULDPX;
+	      else Pending_enc28j60_config &= (uint8_t)~ENC28J60_CFG_FULDPX;
+	    }
+	    if (pSocket->nParseLeft > 0) pSocket->nParseLeft--;
+            pBuffer++;
+          }
+	  
           pSocket->ParseState = PARSE_DELIM;
         }
 	
@@ -2173,53 +2569,75 @@ void HttpDCall(	uint8_t* pBuffer, uint16_t nBytes, struct tHttpD* pSocket)
           break;
         }
       }
+#if HTTP_KEEPALIVE_SUPPORT == 1
+      // The rest of the request is only at hand now
+      if (pSocket->nState == STATE_SENDHEADER
+       && ++pSocket->nRequests < HTTP_KEEPALIVE_MAX) {
+        pSocket->nKeepAlive = HttpDKeepAlive(pBuffer, nBytes);
+      }
+#endif /* HTTP_KEEPALIVE_SUPPORT == 1 */
     }
 
+#if UIP_TCP_WINDOW > 1
+    // Segments already in flight may leave no room for another one. The
+    // data would be lost as uip does not ask for it again.
+    if (!uip_sendable()) return;
+#endif /* UIP_TCP_WINDOW > 1 */
+
     if (pSocket->nState == STATE_SENDHEADER) {
-      uip_send(uip_appdata, CopyHttpHeader(uip_appdata, pSocket->nDataLeft));
+      // The header is sent along with the first data of the page
+      // (nPrevBytes is 0xFFFF until then)
       pSocket->nState = STATE_SENDDATA;
-      return;
+#if UIP_STATISTICS == 1
+      uip_stat.http.requests++;
+#endif /* UIP_STATISTICS == 1 */
+#if PAGE_CACHE_SUPPORT == 1
+      if (HttpDCacheLookup(pSocket)) {
+        // Send the page from the cache. nDataLeft now counts rendered bytes.
+        pSocket->nDataLeft = nCacheLen;
+        pSocket->nState = STATE_SENDCACHE;
+      }
+#endif /* PAGE_CACHE_SUPPORT == 1 */
     }
 
-    if (pSocket->nState == STATE_SENDDATA) {
-      //We have sent the HTML Header or HTML Data previously.
-      //Now we send (further) Data depending on the Socket's pData pointer
-      //If all data has been sent, we close the connection
-      pSocket->nPrevBytes = pSocket->nDataLeft;
-      nBufSize = CopyHttpData(uip_appdata, &pSocket->pData, &pSocket->nDataLeft, uip_mss());
-      pSocket->nPrevBytes -= pSocket->nDataLeft;
-			
-      if (nBufSize == 0) {
+    if (pSocket->nState == STATE_SENDDATA || pSocket->nState == STATE_SENDCACHE) {
+      //Send (further) Data depending on the Socket's pData pointer or the
+      //page cache. If all data has been sent, we close the connection
+      if (HttpDSendSegment(pSocket) == 0) {
+#if UIP_TCP_WINDOW > 1
+        // Wait until every segment in flight is acknowledged
+        if (uip_outstanding(uip_conn)) return;
+#endif /* UIP_TCP_WINDOW > 1 */
+#if HTTP_KEEPALIVE_SUPPORT == 1
+        // Wait for the next request once the last segment is acknowledged
+        if (pSocket->nKeepAlive && pSocket->nRequests < HTTP_KEEPALIVE_MAX) return;
+#endif /* HTTP_KEEPALIVE_SUPPORT == 1 */
         //No Data has been copied. Close connection
         uip_close();
       }
-      else {
-        //Else send copied data
-        uip_send(uip_appdata, nBufSize);
-      }
       return;
     }
   }
+
+#if HTTP_KEEPALIVE_SUPPORT == 1
+  else if (uip_poll() && pSocket->nState == STATE_CONNECTED && pSocket->nRequests != 0) {
+    // A kept alive connection is closed if the next request takes too long
+    if (++pSocket->nIdle >= HTTP_KEEPALIVE_IDLE) uip_close();
+  }
+#endif /* HTTP_KEEPALIVE_SUPPORT == 1 */
   
   else if (uip_rexmit()) {
-    if (pSocket->nPrevBytes == 0xFFFF) {
-      /* Send header again */
-      uip_send(uip_appdata, CopyHttpHeader(uip_appdata, pSocket->nDataLeft));
-    }
-    else {
-      pSocket->pData -= pSocket->nPrevBytes;
-      pSocket->nDataLeft += pSocket->nPrevBytes;
-      pSocket->nPrevBytes = pSocket->nDataLeft;
-      nBufSize = CopyHttpData(uip_appdata, &pSocket->pData, &pSocket->nDataLeft, uip_mss());
-      pSocket->nPrevBytes -= pSocket->nDataLeft;
-      if (nBufSize == 0) {
-        //No Data has been copied. Close connection
-        uip_close();
-      }
-      else {
-        //Else send copied data
-        uip_send(uip_appdata, nBufSize);
+    if (pSocket->nState == STATE_SENDDATA || pSocket->nState == STATE_SENDCACHE) {
+      // Step back over the data of the last segment and build it again. If
+      // it started with the header nPrevBytes goes back to 0xFFFF so the
+      // header is put in front of the data again.
+      if (pSocket->nPrevBytes != 0xFFFF) {
+        if (pSocket->nState == STATE_SENDDATA) pSocket->pData -= pSocket->nPrevBytes;
+        pSocket->nDataLeft += pSocket->nPrevBytes;
+        if (pSocket->nHeader != 0) pSocket->nPrevBytes = 0xFFFF;
       }
+      //No Data has been copied. Close connection
+      if (HttpDSendSegment(pSocket) == 0) uip_close();
     }
     return;
   }
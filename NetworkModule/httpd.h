@@ -60,12 +60,16 @@ struct tHttpD
   uint8_t ParseNum;
   uint8_t ParseState;
   uint16_t nPrevBytes;
+  uint8_t nHeader;      // Length of the HTTP header that starts the last segment, 0 if none
+  uint8_t nKeepAlive;   // 1 if the connection is kept open after the response
+  uint8_t nRequests;    // Requests received on the connection
+  uint8_t nIdle;        // Periodic timer ticks waiting for a request
 };
 
 
 static uint16_t CopyStringP(uint8_t** ppBuffer, const char* pString);
 static uint16_t CopyValue(uint8_t** ppBuffer, uint32_t nValue);
-static uint16_t CopyHttpHeader(uint8_t* pBuffer, uint32_t nDataLen);
+static uint16_t CopyHttpHeader(uint8_t* pBuffer, uint32_t nDataLen, uint8_t nKeepAlive);
 static uint16_t CopyHttpData(uint8_t* pBuffer, const char** ppData, uint16_t* pDataLeft, uint16_t nMaxBytes);
 
 uint8_t three_alpha_to_uint(uint8_t alpha1, uint8_t alpha2, uint8_t alpha3);
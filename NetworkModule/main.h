@@ -26,6 +26,7 @@ int main(void);
 void unlock_eeprom(void);
 void check_eeprom_settings(void);
 void check_runtime_changes(void);
+void fill_tcp_window(void);
 void read_input_registers(void);
 void write_output_registers(void);
 void check_reset_button(void);
@@ -2,6 +2,7 @@
  *	Copyright (c) 2008 by COSMIC Software
  */
 extern void _stext();		/* startup routine */
+extern @far @interrupt void Enc28j60Interrupt(void); /* ENC28J60 -INT on PC5 */
 
 #pragma section const {vector}
 
@@ -13,7 +14,7 @@ void (* const @vector _vectab[32])() = {
 	0,			/* CLK         */
 	0,			/* EXTI0       */
 	0,			/* EXTI1       */
-	0,			/* EXTI2       */
+	Enc28j60Interrupt,	/* EXTI2       */
 	0,			/* EXTI3       */
 	0,			/* EXTI4       */
 	0,0,			/* Reserved    */
@@ -30,6 +30,7 @@
 			// See C:\Program Files (x86)\COSMIC\FSE_Compilers\CXSTM8\Hstm8 directory
 #include <stm8s-005.h>	// Bit location definitions in registers
 			// See C:\Users\Mike\Desktop\STM8S Peripheral Library\en.stsw-stm8069\STM8S_StdPeriph_Lib\Libraries\STM8S_StdPeriph_Driver\inc directory
+#include "uipopt.h"
 
 
 unsigned char arp_timer;  // Arp_timer counter. This counter is incremented by 1 each time the
@@ -126,7 +127,12 @@ void clock_init(void)
   CLK_PCKENR1 |= (uint8_t)0x40;		// Enable clock to TIM3
   CLK_PCKENR1 &= (uint8_t)(~0x10);	// Disable clock to TIM4
   CLK_PCKENR1 &= (uint8_t)(~0x08);	// Disable clock to UART
+#if SPI_SUPPORT == 1
   CLK_PCKENR1 &= (uint8_t)(~0x02);	// Disable clock to SPI
+#endif /* SPI_SUPPORT == 1 */
+#if SPI_SUPPORT == 2
+  CLK_PCKENR1 |= (uint8_t)0x02;		// Enable clock to SPI
+#endif /* SPI_SUPPORT == 2 */
   CLK_PCKENR1 &= (uint8_t)(~0x01);	// Disable clock to I2C
   CLK_PCKENR2 &= (uint8_t)(~0x08);	// Disable clock to ADC
   CLK_PCKENR2 &= (uint8_t)(~0x04);	// Disable clock to AWU
@@ -142,6 +148,19 @@ void clock_init(void)
   // The TIM4 counter can have a pre-scale value of 2 to the X power,
   // where X is 0 to 7.
 
+  // Configure TIM1
+  // Configure TIM1 as a free running millisecond clock for TCP round trip
+  // time measurement and retransmission time-outs. The below will divide
+  // 16MHz by 16000, yielding a 1kHz clock with a period of 1ms. The
+  // counter wraps after 65.536 seconds. See the clock_ms function.
+  TIM1_PSCRH = (uint8_t)0x3e;		// Prescaler 16000 - 1 = 0x3e7f
+  TIM1_PSCRL = (uint8_t)0x7f;
+  // Enable TIM1
+  TIM1_CR1 = (uint8_t)0x01;
+  // Set UG bit to load the PSCR. The bit is auto-cleared by hardware.
+  TIM1_EGR = (uint8_t)0x01;
+
+
   // Configure TIM2
   // Configure TIM2 to increment at close to 1000 ticks per second. The
   // below will divide 16MHz by 16384, yielding a 976Hz clock with a
@@ -191,6 +210,22 @@ periodic_timer_expired(void)
 }
 
 
+uint16_t
+clock_ms(void)
+{
+  // This function returns the free running millisecond clock (TIM1). Time
+  // differences must be computed with unsigned 16 bit arithmetic.
+  //
+  // The high byte must be read first. Reading it latches the low byte so
+  // that both come from the same count.
+  uint16_t count;
+
+  count = (uint16_t)((uint16_t)TIM1_CNTRH << 8);
+  count |= (uint8_t)TIM1_CNTRL;
+  return count;
+}
+
+
 uint8_t
 arp_timer_expired(void)
 {
@@ -28,6 +28,7 @@
 void clock_init(void);
 uint8_t periodic_timer_expired(void);
 uint8_t arp_timer_expired(void);
+uint16_t clock_ms(void);
 void wait_timer(uint16_t wait);
 
 
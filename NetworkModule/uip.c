@@ -105,6 +105,8 @@
 #include "uip.h"
 #include "uipopt.h"
 #include "uip_arch.h"
+#include "Enc28j60.h"
+#include "timer.h"
 
 #include <string.h>
 
@@ -142,6 +144,11 @@ char *uip_sappdata;                   /* The uip_appdata pointer points to the a
 
 uint16_t uip_len, uip_slen;           /* The uip_len is 16 bits. */
 
+#if ! UIP_ARCH_CHKSUM
+static uint16_t uip_ssum, uip_ssumlen; /* Sum and length of the data given to
+                                         uip_send_chksum(), 0 length if none. */
+#endif /* UIP_ARCH_CHKSUM */
+
 uint8_t uip_flags;                    /* The uip_flags variable is used for communication
                                          between the TCP/IP stack and the application program. */
 				      
@@ -152,6 +159,16 @@ struct uip_conn uip_conns[UIP_CONNS]; /* The uip_conns array holds all TCP conne
 uint16_t uip_listenports[UIP_LISTENPORTS]; /* The uip_listenports list all currently listning
                                               ports. */
 
+/* Connection demultiplexing hints. uip_lastconn is the connection that
+   received the last segment and uip_connhash holds, for each hash of the
+   port pair, the index of the connection last found with it. Both are
+   only hints, the connection they point to is always checked. */
+#if (UIP_CONNHASH_SIZE & (UIP_CONNHASH_SIZE - 1)) != 0
+#error "UIP_CONNHASH_SIZE must be a power of 2"
+#endif
+static struct uip_conn *uip_lastconn;
+static uint8_t uip_connhash[UIP_CONNHASH_SIZE];
+
 static uint16_t ipid;                 /* Ths ipid variable is an increasing number that is used
                                          for the IP ID field. */
 
@@ -160,13 +177,16 @@ void uip_setipid(uint16_t id)
   ipid = id;
 }
 
-static uint8_t iss[4];                /* The iss variable is used for the TCP initial 
+static uint32_t iss;                  /* The iss variable is used for the TCP initial 
                                          sequence number. */
 
 /* Temporary variables. */
+#if ! UIP_ARCH_ADD32
 uint8_t uip_acc32[4];
+#endif /* UIP_ARCH_ADD32 */
 static uint8_t c, opt;
 static uint16_t tmp16;
+static uint32_t tmp32;
 
 /* Structures and definitions. */
 #define TCP_FIN 0x01
@@ -198,6 +218,12 @@ static uint16_t tmp16;
 
 /* Macros. */
 #define BUF ((struct uip_tcpip_hdr *)&uip_buf[UIP_LLH_LEN])
+#define CONN_HASH() ((uint8_t)(((uint8_t)BUF->srcport ^ (uint8_t)(BUF->srcport >> 8) \
+                     ^ (uint8_t)BUF->destport) & (UIP_CONNHASH_SIZE - 1)))
+#define CONN_MATCH(conn) ((conn)->tcpstateflags != UIP_CLOSED \
+                          && BUF->destport == (conn)->lport \
+                          && BUF->srcport == (conn)->rport \
+                          && uip_ipaddr_cmp(BUF->srcipaddr, (conn)->ripaddr))
 #define FBUF ((struct uip_tcpip_hdr *)&uip_reassbuf[0])
 #define ICMPBUF ((struct uip_icmpip_hdr *)&uip_buf[UIP_LLH_LEN])
 
@@ -237,9 +263,14 @@ void uip_add32(uint8_t *op32, uint16_t op16)
 #endif /* UIP_ARCH_ADD32 */
 
 
-#if ! UIP_ARCH_CHKSUM
+/* The software checksum functions are needed even with UIP_ARCH_CHKSUM as
+   incoming segments are always verified here. UIP_ARCH_CHKSUM only moves the
+   outgoing TCP checksum to the ENC28J60; UIP_ASM_CHKSUM selects the STM8
+   assembly kernel below. */
 /*---------------------------------------------------------------------------*/
-static uint16_t chksum(uint16_t sum, const uint8_t *data, uint16_t len)
+/* Portable checksum. Also the reference for the STM8 kernel, copied into
+   tools/chksum_test.c; keep the two in step. */
+static uint16_t chksum_c(uint16_t sum, const uint8_t *data, uint16_t len)
 {
   uint16_t t;
   const uint8_t *dataptr;
@@ -265,6 +296,91 @@ static uint16_t chksum(uint16_t sum, const uint8_t *data, uint16_t len)
 }
 
 
+#if UIP_ASM_CHKSUM == 1
+/*---------------------------------------------------------------------------*/
+/* STM8 checksum kernel. Operands are passed in page 0 variables so the
+   assembly can use short addressing. */
+@tiny static uint16_t chk_acc;      /* Running sum, high byte first */
+@tiny static const uint8_t *chk_ptr; /* Next data byte */
+@tiny static uint8_t chk_cnt;       /* Number of 8 byte blocks, 1 to 255 */
+
+/* Adds chk_cnt blocks of 8 bytes at chk_ptr to chk_acc and advances
+   chk_ptr. The low byte of the sum is kept in A and the high byte in YL,
+   so each 16 bit word takes two ADC and two EXG. The carry runs from word
+   to word through the ADC chain (EXG, INCW and DEC leave it alone) and is
+   added back in once at the end. The loop is unrolled 4 words. */
+static void chksum_kernel(void)
+{
+#asm
+	ldw	x,_chk_ptr
+	ld	a,_chk_acc
+	ld	yl,a
+	ld	a,_chk_acc+1
+	rcf
+chk_loop:
+	adc	a,(1,x)
+	exg	a,yl
+	adc	a,(x)
+	exg	a,yl
+	adc	a,(3,x)
+	exg	a,yl
+	adc	a,(2,x)
+	exg	a,yl
+	adc	a,(5,x)
+	exg	a,yl
+	adc	a,(4,x)
+	exg	a,yl
+	adc	a,(7,x)
+	exg	a,yl
+	adc	a,(6,x)
+	exg	a,yl
+	incw	x
+	incw	x
+	incw	x
+	incw	x
+	incw	x
+	incw	x
+	incw	x
+	incw	x
+	dec	_chk_cnt
+	jrne	chk_loop
+	adc	a,#0
+	exg	a,yl
+	adc	a,#0
+	exg	a,yl
+	jrnc	chk_done
+	inc	a
+chk_done:
+	ld	_chk_acc+1,a
+	ld	a,yl
+	ld	_chk_acc,a
+	ldw	_chk_ptr,x
+#endasm
+}
+
+
+/*---------------------------------------------------------------------------*/
+static uint16_t chksum(uint16_t sum, const uint8_t *data, uint16_t len)
+{
+  uint16_t blocks;
+
+  chk_acc = sum;
+  chk_ptr = data;
+  blocks = len >> 3;
+  while (blocks != 0) {
+    chk_cnt = (blocks > 255) ? 255 : (uint8_t)blocks;
+    blocks -= chk_cnt;
+    chksum_kernel();
+  }
+
+  /* The last 0 to 7 bytes */
+  return chksum_c(chk_acc, chk_ptr, (uint16_t)(len & 7));
+}
+#else
+#define chksum chksum_c
+#endif /* UIP_ASM_CHKSUM == 1 */
+
+
 /*---------------------------------------------------------------------------*/
 uint16_t uip_chksum(uint16_t *data, uint16_t len)
 {
@@ -312,6 +428,25 @@ uint16_t uip_tcpchksum(void)
 {
   return upper_layer_chksum(UIP_PROTO_TCP);
 }
+
+
+#if ! UIP_ARCH_CHKSUM
+/*---------------------------------------------------------------------------*/
+/* TCP checksum of an outgoing segment whose data sums to datasum. Only the
+   pseudo header and the TCP header are summed here. The data starts at an
+   even offset, so its sum can simply be added. */
+static uint16_t tcp_hdr_chksum(uint16_t datasum)
+{
+  uint16_t sum;
+
+  sum = (((uint16_t)(BUF->len[0]) << 8) + BUF->len[1]) - UIP_IPH_LEN + UIP_PROTO_TCP;
+  sum = chksum(sum, (uint8_t *)&BUF->srcipaddr[0], 2 * sizeof(uip_ipaddr_t));
+  sum = chksum(sum, &uip_buf[UIP_IPH_LEN + UIP_LLH_LEN], UIP_TCPH_LEN);
+  sum += datasum;
+  if (sum < datasum) sum++; /* carry */
+
+  return (sum == 0) ? 0xffff : htons(sum);
+}
 #endif /* UIP_ARCH_CHKSUM */
 
 
@@ -320,6 +455,8 @@ void uip_init(void)
 {
   for (c = 0; c < UIP_LISTENPORTS; ++c) uip_listenports[c] = 0;
   for (c = 0; c < UIP_CONNS; ++c) uip_conns[c].tcpstateflags = UIP_CLOSED;
+  for (c = 0; c < UIP_CONNHASH_SIZE; ++c) uip_connhash[c] = 0;
+  uip_lastconn = &uip_conns[0];
   /* IPv4 initialization. */
 
 #if UIP_STATISTICS == 1
@@ -356,6 +493,16 @@ void uip_init_stats(void)
   uip_stat.tcp.rexmit = 0;
   uip_stat.tcp.syndrop = 0;
   uip_stat.tcp.synrst = 0;
+  uip_stat.eth.skipped = 0;
+  uip_stat.eth.oversize = 0;
+  uip_stat.eth.rxerror = 0;
+  uip_stat.eth.overflow = 0;
+  uip_stat.eth.rxreset = 0;
+  uip_stat.arp.hit = 0;
+  uip_stat.arp.miss = 0;
+  uip_stat.arp.evict = 0;
+  uip_stat.http.requests = 0;
+  uip_stat.http.deferred = 0;
 #endif /* UIP_STATISTICS == 1 */
 }
 
@@ -384,14 +531,53 @@ void uip_listen(uint16_t port)
 }
 
 
+#if UIP_TCP_WINDOW > 1
+/*---------------------------------------------------------------------------*/
+uint8_t uip_window_open(struct uip_conn *conn)
+{
+  /* Another segment may be sent if every segment in flight is pinned in the
+     ENC28J60, fewer than UIP_TCP_WINDOW are in flight, the remote host's
+     window takes a full segment more and a TX slot can be pinned. A segment
+     that was not pinned (its frame was replaced by an ARP request) stops the
+     window from growing, so only the newest segment ever needs rebuilding. */
+  return (uint8_t)((conn->tcpstateflags & UIP_TS_MASK) == UIP_ESTABLISHED
+    && conn->nseg != 0
+    && conn->nseg < UIP_TCP_WINDOW
+    && Enc28j60Pinned(conn) == conn->nseg
+    && (uint32_t)conn->len + conn->mss <= conn->snd_wnd
+    && Enc28j60CanPin());
+}
+#endif /* UIP_TCP_WINDOW > 1 */
+
+
+/*---------------------------------------------------------------------------*/
+static uint16_t uip_rto(struct uip_conn *conn)
+{
+  /* The retransmission time-out in ms: the smoothed RTT plus four times
+     its variation, as in VJs paper. */
+  uint16_t rto;
+
+  rto = (uint16_t)((conn->sa >> 3) + conn->sv);
+  if (rto < UIP_RTO_MIN) rto = UIP_RTO_MIN;
+  if (rto > UIP_RTO_MAX) rto = UIP_RTO_MAX;
+  return rto;
+}
+
+
+/*---------------------------------------------------------------------------*/
+static void uip_rtt_start(struct uip_conn *conn)
+{
+  /* Time the segment just added to the outstanding data for the RTT
+     estimation. It is acknowledged once conn->len bytes are. */
+  conn->rtt_start = clock_ms();
+  conn->rtt_len = conn->len;
+}
+
+
 /*---------------------------------------------------------------------------*/
 static void uip_add_rcv_nxt(uint16_t n)
 {
-  uip_add32(uip_conn->rcv_nxt, n);
-  uip_conn->rcv_nxt[0] = uip_acc32[0];
-  uip_conn->rcv_nxt[1] = uip_acc32[1];
-  uip_conn->rcv_nxt[2] = uip_acc32[2];
-  uip_conn->rcv_nxt[3] = uip_acc32[3];
+  uip_conn->rcv_nxt += n;
 }
 
 
@@ -404,7 +590,14 @@ void uip_process(uint8_t flag)
 
   /* Check if we were invoked because of a poll request for a particular connection. */
   if (flag == UIP_POLL_REQUEST) {
+#if UIP_TCP_WINDOW > 1
+    uip_len = 0;
+    uip_slen = 0;
+    if ((uip_connr->tcpstateflags & UIP_TS_MASK) == UIP_ESTABLISHED
+      && (!uip_outstanding(uip_connr) || uip_window_open(uip_connr))) {
+#else
     if ((uip_connr->tcpstateflags & UIP_TS_MASK) == UIP_ESTABLISHED && !uip_outstanding(uip_connr)) {
+#endif /* UIP_TCP_WINDOW > 1 */
       uip_flags = UIP_POLL;
       UIP_APPCALL();
       goto appsend;
@@ -412,16 +605,11 @@ void uip_process(uint8_t flag)
     goto drop;
   }
   
-  /* Check if we were invoked because of the perodic timer fireing. */
-  else if (flag == UIP_TIMER) {
+  /* Check if we were invoked because of the perodic timer fireing, or to
+     check the retransmission timer. */
+  else if (flag == UIP_TIMER || flag == UIP_REXMIT_TIMER) {
     /* Increase the initial sequence number. */
-    if (++iss[3] == 0) {
-      if (++iss[2] == 0) {
-        if (++iss[1] == 0) {
-          ++iss[0];
-        }
-      }
-    }
+    if (flag == UIP_TIMER) ++iss;
 
     /* Reset the length variables. */
     uip_len = 0;
@@ -431,22 +619,40 @@ void uip_process(uint8_t flag)
        for the connection to time out. If so, we increase the
        connection's timer and remove the connection if it times
        out. */
-    if (uip_connr->tcpstateflags == UIP_TIME_WAIT || uip_connr->tcpstateflags == UIP_FIN_WAIT_2) {
+    if (flag == UIP_TIMER
+      && (uip_connr->tcpstateflags == UIP_TIME_WAIT || uip_connr->tcpstateflags == UIP_FIN_WAIT_2)) {
       ++(uip_connr->timer);
       if (uip_connr->timer == UIP_TIME_WAIT_TIMEOUT) {
         uip_connr->tcpstateflags = UIP_CLOSED;
       }
+#if UIP_TIME_WAIT_SHORT > 0
+      /* TIME_WAIT is only ever entered by closing the connection from
+         this side, so it can be left early. */
+      if (uip_connr->tcpstateflags == UIP_TIME_WAIT
+        && uip_connr->timer >= UIP_TIME_WAIT_SHORT) {
+        uip_connr->tcpstateflags = UIP_CLOSED;
+      }
+#endif /* UIP_TIME_WAIT_SHORT > 0 */
     }
     else if (uip_connr->tcpstateflags != UIP_CLOSED) {
-      /* If the connection has outstanding data, we increase the
-         connection's timer and see if it has reached the RTO value
-         in which case we retransmit. */
+#if UIP_ACK_DELAY > 0
+      /* Send the delayed ACK if no data segment has carried it in time. */
+      if (uip_connr->ack_due != 0
+        && (int16_t)(clock_ms() - uip_connr->ack_due) >= 0) {
+        goto tcp_send_ack;
+      }
+#endif /* UIP_ACK_DELAY > 0 */
+      /* If the connection has outstanding data, we check if its
+         retransmission time is reached in which case we retransmit. */
       if (uip_outstanding(uip_connr)) {
-        if (uip_connr->timer-- == 0) {
+        if ((int16_t)(clock_ms() - uip_connr->rtx_due) >= 0) {
           if (uip_connr->nrtx == UIP_MAXRTX
 	    || ((uip_connr->tcpstateflags == UIP_SYN_SENT
             || uip_connr->tcpstateflags == UIP_SYN_RCVD)
             && uip_connr->nrtx == UIP_MAXSYNRTX)) {
+#if UIP_TCP_WINDOW > 1
+            Enc28j60Unpin(uip_connr);
+#endif /* UIP_TCP_WINDOW > 1 */
             uip_connr->tcpstateflags = UIP_CLOSED;
 
             /* We call UIP_APPCALL() with uip_flags set to
@@ -460,10 +666,15 @@ void uip_process(uint8_t flag)
             goto tcp_send_nodata;
           }
 
-          /* Exponential backoff. */
-	  if (uip_connr->nrtx > 4) uip_connr->nrtx = 4;
-	  uip_connr->timer = (uint8_t)(UIP_RTO << uip_connr->nrtx);
+          /* Exponential backoff, up to UIP_RTO_MAX. */
 	  ++(uip_connr->nrtx);
+	  tmp16 = uip_rto(uip_connr);
+	  for (c = uip_connr->nrtx; c != 0 && tmp16 < UIP_RTO_MAX; --c) tmp16 <<= 1;
+	  if (tmp16 > UIP_RTO_MAX) tmp16 = UIP_RTO_MAX;
+	  uip_connr->rtx_due = clock_ms() + tmp16;
+
+	  /* A retransmitted segment gives no valid RTT measurement (Karn). */
+	  uip_connr->rtt_len = 0;
 
           /* Ok, so we need to retransmit. We do this differently
              depending on which state we are in. In ESTABLISHED, we
@@ -482,6 +693,23 @@ void uip_process(uint8_t flag)
                  to do the actual retransmit after which we jump into
                  the code for sending out the packet (the apprexmit
                  label). */
+#if UIP_REXMIT_CACHE == 1
+              /* If the segment is still in the ENC28J60 transmit buffer
+                 it is sent again from there and nothing is built. */
+              if (Enc28j60Rexmit(uip_connr)) goto drop;
+#endif /* UIP_REXMIT_CACHE == 1 */
+#if UIP_TCP_WINDOW > 1
+              /* Only the newest segment can be missing from the ENC28J60
+                 (see uip_window_open()). Enc28j60Rexmit has queued the ones
+                 before it again and the application rebuilds it, as the
+                 last segment it sent; it then goes out behind them. In any
+                 other case fall back to stop-and-wait and let the
+                 application rebuild the outstanding data. */
+              if (uip_connr->nseg == 0 || Enc28j60Pinned(uip_connr) + 1 != uip_connr->nseg) {
+                Enc28j60Unpin(uip_connr);
+                uip_connr->nseg = 0;
+              }
+#endif /* UIP_TCP_WINDOW > 1 */
               uip_flags = UIP_REXMIT;
               UIP_APPCALL();
               goto apprexmit;
@@ -495,7 +723,7 @@ void uip_process(uint8_t flag)
           }
         }
       }
-      else if ((uip_connr->tcpstateflags & UIP_TS_MASK) == UIP_ESTABLISHED) {
+      else if (flag == UIP_TIMER && (uip_connr->tcpstateflags & UIP_TS_MASK) == UIP_ESTABLISHED) {
         /* If there was no need for a retransmission, we poll the application for new data. */
         uip_flags = UIP_POLL;
         UIP_APPCALL();
@@ -609,12 +837,23 @@ void uip_process(uint8_t flag)
   }
 
   /* Demultiplex this segment. */
-  /* First check any active connections. */
+  /* First try the connection that got the last segment, then the one the
+     port hash points to. */
+  uip_connr = uip_lastconn;
+  if (CONN_MATCH(uip_connr)) goto found;
+
+  c = CONN_HASH();
+  uip_connr = &uip_conns[uip_connhash[c]];
+  if (CONN_MATCH(uip_connr)) {
+    uip_lastconn = uip_connr;
+    goto found;
+  }
+
+  /* Then check all active connections. */
   for (uip_connr = &uip_conns[0]; uip_connr <= &uip_conns[UIP_CONNS - 1]; ++uip_connr) {
-    if (uip_connr->tcpstateflags != UIP_CLOSED
-      && BUF->destport == uip_connr->lport
-      && BUF->srcport == uip_connr->rport
-      && uip_ipaddr_cmp(BUF->srcipaddr, uip_connr->ripaddr)) {
+    if (CONN_MATCH(uip_connr)) {
+      uip_connhash[c] = (uint8_t)(uip_connr - &uip_conns[0]);
+      uip_lastconn = uip_connr;
       goto found;
     }
   }
@@ -649,33 +888,11 @@ void uip_process(uint8_t flag)
   uip_len = UIP_IPTCPH_LEN;
   BUF->tcpoffset = 5 << 4;
 
-  /* Flip the seqno and ackno fields in the TCP header. */
-  c = BUF->seqno[3];
-  BUF->seqno[3] = BUF->ackno[3];
-  BUF->ackno[3] = c;
-
-  c = BUF->seqno[2];
-  BUF->seqno[2] = BUF->ackno[2];
-  BUF->ackno[2] = c;
-
-  c = BUF->seqno[1];
-  BUF->seqno[1] = BUF->ackno[1];
-  BUF->ackno[1] = c;
-
-  c = BUF->seqno[0];
-  BUF->seqno[0] = BUF->ackno[0];
-  BUF->ackno[0] = c;
-
-  /* We also have to increase the sequence number we are acknowledging.
-     If the least significant byte overflowed, we need to propagate the
-     carry to the other bytes as well. */
-  if (++BUF->ackno[3] == 0) {
-    if (++BUF->ackno[2] == 0) {
-      if (++BUF->ackno[1] == 0) {
-        ++BUF->ackno[0];
-      }
-    }
-  }
+  /* Flip the seqno and ackno fields in the TCP header. We also have to
+     increase the sequence number we are acknowledging. */
+  tmp32 = uip_get32(BUF->seqno);
+  uip_put32(BUF->seqno, uip_get32(BUF->ackno));
+  uip_put32(BUF->ackno, tmp32 + 1);
 
   /* Swap port numbers. */
   tmp16 = BUF->srcport;
@@ -701,7 +918,9 @@ void uip_process(uint8_t flag)
      unused ones have the tcpstate set to CLOSED. Also, connections in
      TIME_WAIT are kept track of and we'll use the oldest one if no
      CLOSED connections are found. Thanks to Eddie C. Dost for a very
-     nice algorithm for the TIME_WAIT search. */
+     nice algorithm for the TIME_WAIT search. Failing that the oldest
+     connection in FIN_WAIT_2 is used; all its data and its FIN have
+     been acknowledged, only the remote host's FIN is missing. */
   uip_connr = 0;
   for (c = 0; c < UIP_CONNS; ++c) {
     if (uip_conns[c].tcpstateflags == UIP_CLOSED) {
@@ -709,7 +928,14 @@ void uip_process(uint8_t flag)
       break;
     }
     if (uip_conns[c].tcpstateflags == UIP_TIME_WAIT) {
-      if (uip_connr == 0 || uip_conns[c].timer > uip_connr->timer) {
+      if (uip_connr == 0 || uip_connr->tcpstateflags != UIP_TIME_WAIT
+        || uip_conns[c].timer > uip_connr->timer) {
+        uip_connr = &uip_conns[c];
+      }
+    }
+    else if (uip_conns[c].tcpstateflags == UIP_FIN_WAIT_2) {
+      if (uip_connr == 0 || (uip_connr->tcpstateflags == UIP_FIN_WAIT_2
+        && uip_conns[c].timer > uip_connr->timer)) {
         uip_connr = &uip_conns[c];
       }
     }
@@ -725,27 +951,30 @@ void uip_process(uint8_t flag)
   uip_conn = uip_connr;
 
   /* Fill in the necessary fields for the new connection. */
-  uip_connr->rto = uip_connr->timer = UIP_RTO;
+  uip_connr->timer = 0;
   uip_connr->sa = 0;
-  uip_connr->sv = 4;
+  uip_connr->sv = UIP_RTO;
   uip_connr->nrtx = 0;
   uip_connr->lport = BUF->destport;
   uip_connr->rport = BUF->srcport;
   uip_ipaddr_copy(uip_connr->ripaddr, BUF->srcipaddr);
   uip_connr->tcpstateflags = UIP_SYN_RCVD;
 
-  uip_connr->snd_nxt[0] = iss[0];
-  uip_connr->snd_nxt[1] = iss[1];
-  uip_connr->snd_nxt[2] = iss[2];
-  uip_connr->snd_nxt[3] = iss[3];
+  uip_connr->snd_nxt = iss;
   uip_connr->len = 1;
+  uip_connr->rtx_due = clock_ms() + uip_rto(uip_connr);
+  uip_connr->rtt_len = 0;
+  uip_rtt_start(uip_connr);
+#if UIP_ACK_DELAY > 0
+  uip_connr->ack_due = 0;
+#endif /* UIP_ACK_DELAY > 0 */
+#if UIP_TCP_WINDOW > 1
+  uip_connr->snd_wnd = ((uint16_t)BUF->wnd[0] << 8) + (uint16_t)BUF->wnd[1];
+  uip_connr->nseg = 0;
+#endif /* UIP_TCP_WINDOW > 1 */
 
   /* rcv_nxt should be the seqno from the incoming packet + 1. */
-  uip_connr->rcv_nxt[3] = BUF->seqno[3];
-  uip_connr->rcv_nxt[2] = BUF->seqno[2];
-  uip_connr->rcv_nxt[1] = BUF->seqno[1];
-  uip_connr->rcv_nxt[0] = BUF->seqno[0];
-  uip_add_rcv_nxt(1);
+  uip_connr->rcv_nxt = uip_get32(BUF->seqno) + 1;
 
   /* Parse the TCP MSS option, if present. */
   if ((BUF->tcpoffset & 0xf0) > 0x50) {
@@ -806,11 +1035,23 @@ void uip_process(uint8_t flag)
      sequence number of this reset is wihtin our advertised window
      before we accept the reset. */
   if (BUF->flags & TCP_RST) {
+#if UIP_TCP_WINDOW > 1
+    Enc28j60Unpin(uip_connr);
+#endif /* UIP_TCP_WINDOW > 1 */
     uip_connr->tcpstateflags = UIP_CLOSED;
     uip_flags = UIP_ABORT;
     UIP_APPCALL();
     goto drop;
   }
+  /* A SYN for a connection in TIME_WAIT opens a new connection if its
+     sequence number lies beyond the old one (RFC 1122, 4.2.2.13). Remote
+     hosts that poll often reuse their port numbers quickly. */
+  if (uip_connr->tcpstateflags == UIP_TIME_WAIT
+    && (BUF->flags & TCP_CTL) == TCP_SYN
+    && (int32_t)(uip_get32(BUF->seqno) - uip_connr->rcv_nxt) > 0) {
+    uip_connr->tcpstateflags = UIP_CLOSED;
+    goto found_listen;
+  }
   /* Calculated the length of the data, if the application has sent any data to us. */
   c = (uint8_t)((BUF->tcpoffset >> 4) << 2);
   /* uip_len will contain the length of the actual TCP data. This is calculated by
@@ -824,50 +1065,78 @@ void uip_process(uint8_t flag)
   if (!(((uip_connr->tcpstateflags & UIP_TS_MASK) == UIP_SYN_SENT)
     && ((BUF->flags & TCP_CTL) == (TCP_SYN | TCP_ACK)))) {
     if ((uip_len > 0 || ((BUF->flags & (TCP_SYN | TCP_FIN)) != 0))
-      && (BUF->seqno[0] != uip_connr->rcv_nxt[0]
-      || BUF->seqno[1] != uip_connr->rcv_nxt[1]
-      || BUF->seqno[2] != uip_connr->rcv_nxt[2]
-      || BUF->seqno[3] != uip_connr->rcv_nxt[3])) {
+      && uip_get32(BUF->seqno) != uip_connr->rcv_nxt) {
       goto tcp_send_ack;
     }
   }
 
   /* Next, check if the incoming segment acknowledges any outstanding
-     data. If so, we update the sequence number, reset the length of
+     data. If so, we update the sequence number, reduce the length of
      the outstanding data, calculate RTT estimations, and reset the
-     retransmission timer. */
+     retransmission timer. tmp16 is the number of bytes acknowledged. */
   if ((BUF->flags & TCP_ACK) && uip_outstanding(uip_connr)) {
-    uip_add32(uip_connr->snd_nxt, uip_connr->len);
+    tmp32 = uip_get32(BUF->ackno);
+    tmp16 = 0;
+
+#if UIP_TCP_WINDOW > 1
+    /* With several segments in flight the ACK may only cover some of
+       them. */
+    if (uip_connr->nseg != 0) {
+      uip_connr->nseg -= Enc28j60Acked(uip_connr, tmp32, &tmp16);
+    }
+#endif /* UIP_TCP_WINDOW > 1 */
+
+    if (tmp32 == uip_connr->snd_nxt + uip_connr->len) {
+      tmp16 = uip_connr->len;
+#if UIP_TCP_WINDOW > 1
+      /* Everything is acknowledged, including segments that could not be
+         pinned. */
+      if (uip_connr->nseg != 0) {
+        Enc28j60Unpin(uip_connr);
+        uip_connr->nseg = 0;
+      }
+#endif /* UIP_TCP_WINDOW > 1 */
+    }
 
-    if (BUF->ackno[0] == uip_acc32[0]
-      && BUF->ackno[1] == uip_acc32[1]
-      && BUF->ackno[2] == uip_acc32[2]
-      && BUF->ackno[3] == uip_acc32[3]) {
+    if (tmp16 != 0) {
       /* Update sequence number. */
-      uip_connr->snd_nxt[0] = uip_acc32[0];
-      uip_connr->snd_nxt[1] = uip_acc32[1];
-      uip_connr->snd_nxt[2] = uip_acc32[2];
-      uip_connr->snd_nxt[3] = uip_acc32[3];
-
-      /* Do RTT estimation, unless we have done retransmissions. */
-      if (uip_connr->nrtx == 0) {
-        int8_t m;
-        m = (int8_t)(uip_connr->rto - uip_connr->timer);
-        /* This is taken directly from VJs original code in his paper */
-        m = (int8_t)(m - (uip_connr->sa >> 3));
-        uip_connr->sa += m;
-        if (m < 0) m = (int8_t)(-m);
-        m = (int8_t)(m - (uip_connr->sv >> 2));
-        uip_connr->sv += m;
-        uip_connr->rto = (uint8_t)((uip_connr->sa >> 3) + uip_connr->sv);
+      uip_connr->snd_nxt += tmp16;
+
+      /* Do RTT estimation once the timed segment is acknowledged. No
+         segment is timed after retransmissions (rtt_len is 0). */
+      if (uip_connr->rtt_len != 0) {
+        if (tmp16 < uip_connr->rtt_len) {
+          uip_connr->rtt_len -= tmp16;
+        }
+        else {
+          int16_t m;
+          uip_connr->rtt_len = 0;
+          m = (int16_t)(clock_ms() - uip_connr->rtt_start);
+          /* sa holds 8 times the RTT, so longer samples would overflow. */
+          if (m > 8000) m = 8000;
+          if (uip_connr->sa == 0) {
+            /* The first measurement sets the RTT variation to half the
+               RTT (RFC 6298). */
+            uip_connr->sa = (uint16_t)((uint16_t)m << 3);
+            uip_connr->sv = (uint16_t)((uint16_t)m << 1);
+          }
+          else {
+            /* This is taken directly from VJs original code in his paper */
+            m = (int16_t)(m - (uip_connr->sa >> 3));
+            uip_connr->sa += m;
+            if (m < 0) m = (int16_t)(-m);
+            m = (int16_t)(m - (uip_connr->sv >> 2));
+            uip_connr->sv += m;
+          }
+        }
       }
       /* Set the acknowledged flag. */
       uip_flags = UIP_ACKDATA;
       /* Reset the retransmission timer. */
-      uip_connr->timer = uip_connr->rto;
+      uip_connr->rtx_due = clock_ms() + uip_rto(uip_connr);
 
-      /* Reset length of outstanding data. */
-      uip_connr->len = 0;
+      /* Reduce length of outstanding data. */
+      uip_connr->len -= tmp16;
     }
   }
 
@@ -915,6 +1184,8 @@ void uip_process(uint8_t flag)
         }
         UIP_APPCALL();
         uip_connr->len = 1;
+        uip_connr->rtx_due = clock_ms() + uip_rto(uip_connr);
+        uip_rtt_start(uip_connr);
         uip_connr->tcpstateflags = UIP_LAST_ACK;
         uip_connr->nrtx = 0;
         tcp_send_finack: BUF->flags = TCP_FIN | TCP_ACK;
@@ -947,6 +1218,9 @@ void uip_process(uint8_t flag)
          acknowledged by the receiver, and the application will retransmit it. This is
          called the "persistent timer" and uses the retransmission mechanim. */
       tmp16 = ((uint16_t)BUF->wnd[0] << 8) + (uint16_t)BUF->wnd[1];
+#if UIP_TCP_WINDOW > 1
+      uip_connr->snd_wnd = tmp16;
+#endif /* UIP_TCP_WINDOW > 1 */
       if (tmp16 > uip_connr->initialmss || tmp16 == 0) {
         tmp16 = uip_connr->initialmss;
       }
@@ -973,6 +1247,9 @@ void uip_process(uint8_t flag)
 
         if (uip_flags & UIP_ABORT) {
           uip_slen = 0;
+#if UIP_TCP_WINDOW > 1
+          Enc28j60Unpin(uip_connr);
+#endif /* UIP_TCP_WINDOW > 1 */
           uip_connr->tcpstateflags = UIP_CLOSED;
           BUF->flags = TCP_RST | TCP_ACK;
           goto tcp_send_nodata;
@@ -981,6 +1258,8 @@ void uip_process(uint8_t flag)
         if (uip_flags & UIP_CLOSE) {
           uip_slen = 0;
 	  uip_connr->len = 1;
+	  uip_connr->rtx_due = clock_ms() + uip_rto(uip_connr);
+	  uip_rtt_start(uip_connr);
 	  uip_connr->tcpstateflags = UIP_FIN_WAIT_1;
 	  uip_connr->nrtx = 0;
 	  BUF->flags = TCP_FIN | TCP_ACK;
@@ -991,7 +1270,13 @@ void uip_process(uint8_t flag)
         if (uip_slen > 0) {
           /* If the connection has acknowledged data, the contents of the ->len variable
 	     should be discarded. */
+#if UIP_TCP_WINDOW > 1
+	  /* Unless the segments in flight are pinned, in which case ->len
+	     counts the data of those that are not acknowledged yet. */
+	  if ((uip_flags & UIP_ACKDATA) != 0 && uip_connr->nseg == 0) {
+#else
 	  if ((uip_flags & UIP_ACKDATA) != 0) {
+#endif /* UIP_TCP_WINDOW > 1 */
 	    uip_connr->len = 0;
 	  }
 	  
@@ -1007,7 +1292,35 @@ void uip_process(uint8_t flag)
             /* Remember how much data we send out now so that we know when everything has
 	       been acknowledged. */
             uip_connr->len = uip_slen;
+            uip_connr->rtx_due = clock_ms() + uip_rto(uip_connr);
+            uip_rtt_start(uip_connr);
+#if UIP_TCP_WINDOW > 1
+            /* Keep the segment in the ENC28J60 so more can follow it. */
+            uip_connr->nseg = 0;
+            if (Enc28j60CanPin()) {
+              uip_connr->nseg = 1;
+              Enc28j60PinNext();
+            }
+#endif /* UIP_TCP_WINDOW > 1 */
+	  }
+#if UIP_TCP_WINDOW > 1
+	  else if (uip_window_open(uip_connr)) {
+	    /* Add the segment to the ones in flight. */
+	    if (uip_slen > uip_connr->mss) {
+	      uip_slen = uip_connr->mss;
+	    }
+            uip_connr->len += uip_slen;
+            /* Keep timing the segment that is being timed already. */
+            if (uip_connr->rtt_len == 0) uip_rtt_start(uip_connr);
+            ++(uip_connr->nseg);
+            Enc28j60PinNext();
+	  }
+	  else if (uip_connr->nseg != 0) {
+	    /* The window is full. Pinned segments are not rebuilt by the
+	       application, so there is nothing to send. */
+	    uip_slen = 0;
 	  }
+#endif /* UIP_TCP_WINDOW > 1 */
 	  else {
 	    /* If the application already had unacknowledged data, we make sure that the
 	       application does not send (i.e., retransmit) out more than it previously
@@ -1022,7 +1335,12 @@ void uip_process(uint8_t flag)
 	   in it, we must send out a packet. */
 	if (uip_slen > 0 && uip_connr->len > 0) {
 	  /* Add the length of the IP and TCP headers. */
+#if UIP_TCP_WINDOW > 1
+	  /* A segment added to the window only carries the new data. */
+	  uip_len = (uip_connr->nseg != 0 ? uip_slen : uip_connr->len) + UIP_TCPIP_HLEN;
+#else
 	  uip_len = uip_connr->len + UIP_TCPIP_HLEN;
+#endif /* UIP_TCP_WINDOW > 1 */
 	  /* We always set the ACK flag in response packets. */
 	  BUF->flags = TCP_ACK | TCP_PSH;
 	  /* Send the packet. */
@@ -1030,6 +1348,16 @@ void uip_process(uint8_t flag)
 	}
 	/* If there is no data to send, just send out a pure ACK if there is newdata. */
 	if (uip_flags & UIP_NEWDATA) {
+#if UIP_ACK_DELAY > 0
+	  /* Hold the ACK back in case the application replies shortly, but
+	     ACK at least every second segment. */
+	  if (uip_connr->ack_due == 0) {
+	    uip_connr->ack_due = clock_ms() + UIP_ACK_DELAY;
+	    /* 0 means no ACK is pending, so a due time of 0 is made 1ms later. */
+	    if (uip_connr->ack_due == 0) uip_connr->ack_due = 1;
+	    goto drop;
+	  }
+#endif /* UIP_ACK_DELAY > 0 */
 	  uip_len = UIP_TCPIP_HLEN;
 	  BUF->flags = TCP_ACK;
 	  goto tcp_send_noopts;
@@ -1069,6 +1397,7 @@ void uip_process(uint8_t flag)
       }
       else if (uip_flags & UIP_ACKDATA) {
         uip_connr->tcpstateflags = UIP_FIN_WAIT_2;
+        uip_connr->timer = 0;
         uip_connr->len = 0;
         goto drop;
       }
@@ -1124,15 +1453,22 @@ void uip_process(uint8_t flag)
   /* We're done with the input processing. We are now ready to send a reply. Our job is to
      fill in all the fields of the TCP and IP headers before calculating the checksum and
      finally send the packet. */
-  BUF->ackno[0] = uip_connr->rcv_nxt[0];
-  BUF->ackno[1] = uip_connr->rcv_nxt[1];
-  BUF->ackno[2] = uip_connr->rcv_nxt[2];
-  BUF->ackno[3] = uip_connr->rcv_nxt[3];
-
-  BUF->seqno[0] = uip_connr->snd_nxt[0];
-  BUF->seqno[1] = uip_connr->snd_nxt[1];
-  BUF->seqno[2] = uip_connr->snd_nxt[2];
-  BUF->seqno[3] = uip_connr->snd_nxt[3];
+  uip_put32(BUF->ackno, uip_connr->rcv_nxt);
+#if UIP_ACK_DELAY > 0
+  /* Every segment carries the ACK, so none is pending anymore. */
+  uip_connr->ack_due = 0;
+#endif /* UIP_ACK_DELAY > 0 */
+#if UIP_TCP_WINDOW > 1
+  /* With segments in flight snd_nxt is the oldest unacknowledged sequence
+     number. A new segment follows the data already in flight. */
+  tmp32 = uip_connr->snd_nxt;
+  if (uip_connr->nseg != 0) {
+    tmp32 += uip_connr->len - (uip_len - UIP_IPTCPH_LEN);
+  }
+  uip_put32(BUF->seqno, tmp32);
+#else
+  uip_put32(BUF->seqno, uip_connr->snd_nxt);
+#endif /* UIP_TCP_WINDOW > 1 */
 
   BUF->proto = UIP_PROTO_TCP;
   
@@ -1164,7 +1500,17 @@ void uip_process(uint8_t flag)
 
   /* Calculate TCP checksum. */
   BUF->tcpchksum = 0;
-  BUF->tcpchksum = ~(uip_tcpchksum());
+#if ! UIP_ARCH_CHKSUM
+  /* Use the data sum from uip_send_chksum() if this segment carries
+     exactly that data, otherwise sum the whole segment. */
+  if (uip_ssumlen != 0 && uip_len == UIP_IPTCPH_LEN + uip_ssumlen) {
+    BUF->tcpchksum = ~(tcp_hdr_chksum(uip_ssum));
+  }
+  else BUF->tcpchksum = ~(uip_tcpchksum());
+  uip_ssumlen = 0;
+#endif /* UIP_ARCH_CHKSUM */
+  /* With UIP_ARCH_CHKSUM the ENC28J60 DMA fills in the TCP checksum once
+     the frame is in its transmit buffer. See Enc28j60CopyPacket(). */
 
 
 
@@ -1214,6 +1560,9 @@ uint16_t htons(uint16_t val)
 //void uip_send(const void *data, int len)
 void uip_send(const char *data, int len)
 {
+#if ! UIP_ARCH_CHKSUM
+  uip_ssumlen = 0;
+#endif /* UIP_ARCH_CHKSUM */
   if (len > 0) {
     uip_slen = len;
     if (data != uip_sappdata) {
@@ -1221,3 +1570,16 @@ void uip_send(const char *data, int len)
     }
   }
 }
+
+
+#if ! UIP_ARCH_CHKSUM
+/*---------------------------------------------------------------------------*/
+void uip_send_chksum(const char *data, int len, uint16_t sum)
+{
+  uip_send(data, len);
+  if (len > 0) {
+    uip_ssum = sum;
+    uip_ssumlen = (uint16_t)len;
+  }
+}
+#endif /* UIP_ARCH_CHKSUM */
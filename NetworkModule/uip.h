@@ -274,6 +274,19 @@ void uip_setipid(uint16_t id);
 #define uip_periodic(conn) do { uip_conn = &uip_conns[conn]; \
                                 uip_process(UIP_TIMER); } while (0)
 
+/**
+ * Retransmission timer check for a connection identified by its number.
+ * Retransmits the outstanding data of the connection if its retransmission
+ * time-out has passed. Retransmission time-outs are kept in milliseconds,
+ * so this should be called for every connection as often as possible
+ * rather than with the periodic timer. Used like uip_periodic().
+ *
+ * conn - The number of the connection which is to be checked.
+ *
+ */
+#define uip_rexmit_timer(conn) do { uip_conn = &uip_conns[conn]; \
+                                    uip_process(UIP_REXMIT_TIMER); } while (0)
+
 /**
  *
  *
@@ -380,6 +393,19 @@ void uip_unlisten(uint16_t port);
 #define uip_outstanding(conn) ((conn)->len)
 
 
+/**
+ * Check if the application can send data on the current connection now.
+ * With UIP_TCP_WINDOW > 1 this is also true while earlier segments are in
+ * flight, as long as the send window has room (see uip_window_open()).
+ *
+ */
+#if UIP_TCP_WINDOW > 1
+#define uip_sendable() (uip_conn->len == 0 || uip_window_open(uip_conn))
+#else
+#define uip_sendable() (uip_conn->len == 0)
+#endif /* UIP_TCP_WINDOW > 1 */
+
+
 /**
  * Send data on the current connection.
  * This function is used to send out a single segment of TCP data. Only
@@ -403,6 +429,27 @@ void uip_unlisten(uint16_t port);
 void uip_send(const char *data, int len);
 
 
+/**
+ * Send data on the current connection, with its checksum.
+ *
+ * Same as uip_send(), but the caller also passes the 16 bit one's
+ * complement sum of the data (as computed by the checksum functions, with
+ * the first byte as high byte), for instance accumulated while the data
+ * was written. uIP then only sums the TCP/IP headers. If uIP crops the
+ * data the sum is not used. With UIP_ARCH_CHKSUM the checksum is computed
+ * elsewhere and this is plain uip_send().
+ *
+ * data - A pointer to the data which is to be sent.
+ * len - The maximum amount of data bytes to be sent.
+ * sum - The one's complement sum of the len bytes of data.
+ */
+#if ! UIP_ARCH_CHKSUM
+void uip_send_chksum(const char *data, int len, uint16_t sum);
+#else
+#define uip_send_chksum(data, len, sum) uip_send(data, len)
+#endif /* UIP_ARCH_CHKSUM */
+
+
 /**
  * The length of any incoming data that is currently avaliable (if avaliable)
  * in the uip_appdata buffer.
@@ -454,6 +501,16 @@ void uip_send(const char *data, int len);
                               } while(0)
 
 
+/**
+ * Refuse the data that has just arrived on the current connection.
+ * The data is not acknowledged, so the remote host sends it again after its
+ * retransmission timeout. Only valid when uip_newdata() is true.
+ */
+#define uip_refuse()          do { uip_conn->rcv_nxt -= uip_len; \
+                                   uip_flags &= ~UIP_NEWDATA; \
+                              } while(0)
+
+
 /*---------------------------------------------------------------------------*/
 /* uIP tests that can be made to determine in what state the current
  * connection is, and what the application function should do.
@@ -774,6 +831,29 @@ uint16_t htons(uint16_t val);
 #endif
 
 
+/**
+ * Read and write a 32-bit quantity in network byte order, such as the TCP
+ * sequence numbers, as a host byte order uint32_t. The pointer can be
+ * unaligned. On a big endian CPU like the STM8 this is a plain 32-bit load
+ * or store.
+ */
+#if UIP_BYTE_ORDER == UIP_BIG_ENDIAN
+#define uip_get32(p) (*(uint32_t *)(p))
+#define uip_put32(p, v) (*(uint32_t *)(p) = (v))
+#else /* UIP_BYTE_ORDER == UIP_BIG_ENDIAN */
+#define uip_get32(p) (((uint32_t)((uint8_t *)(p))[0] << 24) \
+                    | ((uint32_t)((uint8_t *)(p))[1] << 16) \
+                    | ((uint32_t)((uint8_t *)(p))[2] << 8) \
+                    | (uint32_t)((uint8_t *)(p))[3])
+#define uip_put32(p, v) do { \
+  ((uint8_t *)(p))[0] = (uint8_t)((v) >> 24); \
+  ((uint8_t *)(p))[1] = (uint8_t)((v) >> 16); \
+  ((uint8_t *)(p))[2] = (uint8_t)((v) >> 8); \
+  ((uint8_t *)(p))[3] = (uint8_t)(v); \
+} while (0)
+#endif /* UIP_BYTE_ORDER == UIP_BIG_ENDIAN */
+
+
 /**
  * Pointer to the application data in the packet buffer.
  * This pointer points to the application data when the application is called.
@@ -817,17 +897,26 @@ struct uip_conn {
   uip_ipaddr_t ripaddr;  // The IP address of the remote host.
   uint16_t lport;        // The local TCP port, in network byte order.
   uint16_t rport;        // The local remote TCP port, in network byte order.
-  uint8_t rcv_nxt[4];    // The sequence number that we expect to receive next.
-  uint8_t snd_nxt[4];    // The sequence number that was last sent by us.
+  uint32_t rcv_nxt;      // The sequence number that we expect to receive next.
+  uint32_t snd_nxt;      // The sequence number that was last sent by us.
   uint16_t len;          // Length of the data that was previously sent.
   uint16_t mss;          // Current maximum segment size for the connection.
   uint16_t initialmss;   // Initial maximum segment size for the connection.
-  uint8_t sa;            // Retransmission time-out calculation state variable.
-  uint8_t sv;            // Retransmission time-out calculation state variable.
-  uint8_t rto;           // Retransmission time-out.
+  uint16_t sa;           // Smoothed round trip time in ms times 8, 0 if not measured.
+  uint16_t sv;           // Round trip time variation in ms times 4.
+  uint16_t rtx_due;      // The clock_ms() time of the next retransmission.
+  uint16_t rtt_start;    // The clock_ms() time the timed segment was sent.
+  uint16_t rtt_len;      // Outstanding bytes up to the end of the timed segment, 0 if none.
   uint8_t tcpstateflags; // TCP state and flags.
-  uint8_t timer;         // The retransmission timer.
+  uint8_t timer;         // The TIME_WAIT and FIN_WAIT_2 timer, in periodic timer ticks.
   uint8_t nrtx;          // The number of retransmissions for the last segment sent.
+#if UIP_ACK_DELAY > 0
+  uint16_t ack_due;      // The clock_ms() time a delayed ACK is sent, 0 if none is pending.
+#endif /* UIP_ACK_DELAY > 0 */
+#if UIP_TCP_WINDOW > 1
+  uint16_t snd_wnd;      // The window last advertised by the remote host.
+  uint8_t nseg;          // The number of segments in flight, 0 if not pinned.
+#endif /* UIP_TCP_WINDOW > 1 */
 
   /** The application state. */
   uip_tcp_appstate_t appstate;
@@ -843,10 +932,22 @@ extern struct uip_conn *uip_conn;
 extern struct uip_conn uip_conns[UIP_CONNS];
 
 
+/**
+ * Check if another segment can be sent on a connection that already has
+ * segments in flight (UIP_TCP_WINDOW > 1). A segment sent by the application
+ * when the window is not open is discarded.
+ * conn - A pointer to the uip_conn structure for the connection.
+ *
+ */
+uint8_t uip_window_open(struct uip_conn *conn);
+
+
+#if ! UIP_ARCH_ADD32
 /**
  * 4-byte array used for the 32-bit sequence number calculations.
  */
 extern uint8_t uip_acc32[4];
+#endif /* UIP_ARCH_ADD32 */
 
 
 /**
@@ -882,6 +983,22 @@ struct uip_stats {
     uip_stats_t syndrop;  // Number of dropped SYNs due to too few connections avaliable.
     uip_stats_t synrst;   // Number of SYNs for closed ports, triggering a RST.
   } tcp;                  // TCP statistics.
+  struct {
+    uip_stats_t skipped;  // Number of received frames discarded after reading only the header.
+    uip_stats_t oversize; // Number of received frames dropped for exceeding ENC28J60_MAXFRAME.
+    uip_stats_t rxerror;  // Number of received frames dropped for a receive error.
+    uip_stats_t overflow; // Number of times frames were lost because the RX buffer was full.
+    uip_stats_t rxreset;  // Number of RX resets after a corrupt receive header.
+  } eth;                  // Ethernet driver statistics.
+  struct {
+    uip_stats_t hit;      // Number of outgoing IP packets that found their ARP table entry.
+    uip_stats_t miss;     // Number of outgoing IP packets that needed an ARP request.
+    uip_stats_t evict;    // Number of ARP table entries thrown away to make room.
+  } arp;                  // ARP statistics.
+  struct {
+    uip_stats_t requests; // Number of HTTP requests answered.
+    uip_stats_t deferred; // Number of HTTP requests refused while a response was being sent.
+  } http;                 // Web server statistics.
 };
 
 
@@ -962,6 +1079,9 @@ void uip_process(uint8_t flag);
 #define UIP_POLL_REQUEST  3
 /* Tells uIP that a connection should be polled. */
 
+#define UIP_REXMIT_TIMER  4
+/* Tells uIP to check the retransmission timer of a connection. */
+
 /* The TCP states used in the uip_conn->tcpstateflags. */
 #define UIP_CLOSED      0
 #define UIP_SYN_RCVD    1
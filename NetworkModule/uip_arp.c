@@ -80,6 +80,7 @@
 
 #include "uip_arp.h"
 #include "main.h"
+#include "Enc28j60.h"
 
 #include <string.h>
 
@@ -115,8 +116,21 @@ struct ethip_hdr {
 #define ARP_REPLY   2
 #define ARP_HWTYPE_ETH 1
 
+/* The ARP table is open addressed. The entry for an IP address is in one of
+   the UIP_ARP_PROBES slots starting at the slot given by ARP_HASH of the two
+   low bytes of the address, wrapping at the end of the table. */
+#if (UIP_ARPTAB_SIZE & (UIP_ARPTAB_SIZE - 1)) != 0
+#error "UIP_ARPTAB_SIZE must be a power of 2"
+#endif
+#if UIP_ARP_PROBES > UIP_ARPTAB_SIZE
+#error "UIP_ARP_PROBES must not be larger than UIP_ARPTAB_SIZE"
+#endif
+
+#define ARP_HASH(ip) ((uint8_t)(((uint8_t)(ip) ^ (uint8_t)((ip) >> 8)) & (UIP_ARPTAB_SIZE - 1)))
+#define ARP_NEXT(c)  ((uint8_t)(((c) + 1) & (UIP_ARPTAB_SIZE - 1)))
+
 struct arp_entry {
-  uint16_t ipaddr[2];
+  uint32_t ipaddr;              /* IP address in host byte order, 0 = unused */
   struct uip_eth_addr ethaddr;
   uint8_t time;
 };
@@ -132,9 +146,30 @@ static uint8_t i, c;
 static uint8_t arptime;
 static uint8_t tmpage;
 
+#if UIP_ARP_ANNOUNCE > 0
+/* Gratuitous ARP announcements still to be sent, the number of periodic
+   timer ticks until the next one and the wait after it. */
+static uint8_t announce_count;
+static uint8_t announce_wait;
+static uint8_t announce_backoff;
+#endif /* UIP_ARP_ANNOUNCE > 0 */
+
+#if ARP_PARK_SUPPORT == 1
+/* Next hop IP address of the packet parked in the ENC28J60 (0 = none) and
+   the arptime when it was parked. */
+static uint16_t park_ipaddr[2];
+static uint8_t park_time;
+#endif /* ARP_PARK_SUPPORT == 1 */
+
 #define BUF   ((struct arp_hdr *)&uip_buf[0])
 #define IPBUF ((struct ethip_hdr *)&uip_buf[0])
 
+#if UIP_STATISTICS == 1
+#define UIP_STAT(s) s
+#else
+#define UIP_STAT(s)
+#endif /* UIP_STATISTICS == 1 */
+
 /*-----------------------------------------------------------------------------------*/
 /**
  * Initialize the ARP module.
@@ -144,9 +179,7 @@ static uint8_t tmpage;
 void
 uip_arp_init(void)
 {
-  for(i = 0; i < UIP_ARPTAB_SIZE; ++i) {
-    memset(arp_table[i].ipaddr, 0, 4);
-  }
+  memset(arp_table, 0, sizeof(arp_table));
 }
 
 
@@ -168,77 +201,133 @@ uip_arp_timer(void)
   ++arptime;
   for(i = 0; i < UIP_ARPTAB_SIZE; ++i) {
     tabptr = &arp_table[i];
-    if((tabptr->ipaddr[0] | tabptr->ipaddr[1]) != 0 &&
+    if(tabptr->ipaddr != 0 &&
        arptime - tabptr->time >= UIP_ARP_MAXAGE) {
-      memset(tabptr->ipaddr, 0, 4);
+      tabptr->ipaddr = 0;
     }
   }
 
+#if ARP_PARK_SUPPORT == 1
+  /* Give up on a parked packet if its ARP request was not answered. */
+  if((park_ipaddr[0] | park_ipaddr[1]) != 0 &&
+     (uint8_t)(arptime - park_time) >= 2) {
+    Enc28j60ParkDrop();
+    memset(park_ipaddr, 0, 4);
+  }
+#endif /* ARP_PARK_SUPPORT == 1 */
 }
 
 
 /*-----------------------------------------------------------------------------------*/
-static void
-uip_arp_update(uint16_t *ipaddr, struct uip_eth_addr *ethaddr)
+/* Returns the ARP table entry for the IP address ip (host byte order), or 0
+   if there is none. */
+static struct arp_entry *
+uip_arp_lookup(uint32_t ip)
 {
   register struct arp_entry *tabptr;
-  /* Walk through the ARP mapping table and try to find an entry to
-     update. If none is found, the IP -> MAC address mapping is
-     inserted in the ARP table. */
-  for(i = 0; i < UIP_ARPTAB_SIZE; ++i) {
 
-    tabptr = &arp_table[i];
-    /* Only check those entries that are actually in use. */
-    if(tabptr->ipaddr[0] != 0 &&
-       tabptr->ipaddr[1] != 0) {
-
-      /* Check if the source IP address of the incoming packet matches
-         the IP address in this ARP table entry. */
-      if(ipaddr[0] == tabptr->ipaddr[0] &&
-	 ipaddr[1] == tabptr->ipaddr[1]) {
-	 
-	/* An old entry found, update this and return. */
-	memcpy(tabptr->ethaddr.addr, ethaddr->addr, 6);
-	tabptr->time = arptime;
-
-	return;
-      }
+  if(ip == 0) {
+    return 0;
+  }
+  c = ARP_HASH(ip);
+  for(i = 0; i < UIP_ARP_PROBES; ++i) {
+    tabptr = &arp_table[c];
+    if(tabptr->ipaddr == ip) {
+      return tabptr;
     }
+    c = ARP_NEXT(c);
   }
+  return 0;
+}
 
-  /* If we get here, no existing ARP table entry was found, so we
-     create one. */
 
-  /* First, we try to find an unused entry in the ARP table. */
-  for(i = 0; i < UIP_ARPTAB_SIZE; ++i) {
-    tabptr = &arp_table[i];
-    if(tabptr->ipaddr[0] == 0 &&
-       tabptr->ipaddr[1] == 0) {
-      break;
+/*-----------------------------------------------------------------------------------*/
+static void
+uip_arp_update(uint16_t *ipaddr, struct uip_eth_addr *ethaddr)
+{
+  register struct arp_entry *tabptr;
+  struct arp_entry *freeptr;
+  uint32_t ip;
+
+#if ARP_PARK_SUPPORT == 1
+  /* If a packet is waiting for this address, send it now. */
+  if(uip_ipaddr_cmp(ipaddr, park_ipaddr)) {
+    Enc28j60ParkRelease(ethaddr->addr);
+    memset(park_ipaddr, 0, 4);
+  }
+#endif /* ARP_PARK_SUPPORT == 1 */
+
+  ip = uip_get32(ipaddr);
+  if(ip == 0) {
+    return;
+  }
+
+  /* Walk through the slots the address can be in and try to find an
+     entry to update. If none is found, the IP -> MAC address mapping is
+     inserted in the first unused slot. */
+  freeptr = 0;
+  c = ARP_HASH(ip);
+  for(i = 0; i < UIP_ARP_PROBES; ++i) {
+    tabptr = &arp_table[c];
+    if(tabptr->ipaddr == ip) {
+      /* An old entry found, update this and return. */
+      memcpy(tabptr->ethaddr.addr, ethaddr->addr, 6);
+      tabptr->time = arptime;
+      return;
     }
+    if(tabptr->ipaddr == 0 && freeptr == 0) {
+      freeptr = tabptr;
+    }
+    c = ARP_NEXT(c);
   }
 
-  /* If no unused entry is found, we try to find the oldest entry and
-     throw it away. */
-  if(i == UIP_ARPTAB_SIZE) {
+  /* If no unused slot is found, we throw away the oldest entry of
+     those slots. */
+  if(freeptr == 0) {
+    UIP_STAT(++uip_stat.arp.evict);
     tmpage = 0;
-    c = 0;
-    for(i = 0; i < UIP_ARPTAB_SIZE; ++i) {
-      tabptr = &arp_table[i];
-      if(arptime - tabptr->time > tmpage) {
+    c = ARP_HASH(ip);
+    freeptr = &arp_table[c];
+    for(i = 0; i < UIP_ARP_PROBES; ++i) {
+      tabptr = &arp_table[c];
+      if((uint8_t)(arptime - tabptr->time) > tmpage) {
 	tmpage = (uint8_t)(arptime - tabptr->time);
-	c = i;
+	freeptr = tabptr;
       }
+      c = ARP_NEXT(c);
     }
-    i = c;
-    tabptr = &arp_table[i];
   }
 
-  /* Now, i is the ARP table entry which we will fill with the new
-     information. */
-  memcpy(tabptr->ipaddr, ipaddr, 4);
-  memcpy(tabptr->ethaddr.addr, ethaddr->addr, 6);
-  tabptr->time = arptime;
+  freeptr->ipaddr = ip;
+  memcpy(freeptr->ethaddr.addr, ethaddr->addr, 6);
+  freeptr->time = arptime;
+}
+
+
+/*-----------------------------------------------------------------------------------*/
+/**
+ * ARP processing for incoming IP packets
+ *
+ * This function should be called by the device driver when an IP packet has
+ * been received. The function will check if the address is in the ARP cache,
+ * and if so the ARP cache entry is refreshed. If no ARP cache entry was found,
+ * a new one is created.
+ *
+ * Only packets from a host on the local network that are addressed to us are
+ * used, so broadcast traffic does not push useful entries out of the table.
+ * This lets the reply to a new client go out without an ARP request first.
+ */
+/*-----------------------------------------------------------------------------------*/
+void
+uip_arp_ipin(void)
+{
+  if(!uip_ipaddr_maskcmp(IPBUF->srcipaddr, uip_hostaddr, uip_netmask)) {
+    return;
+  }
+  if(!uip_ipaddr_cmp(IPBUF->destipaddr, uip_hostaddr)) {
+    return;
+  }
+  uip_arp_update(IPBUF->srcipaddr, &(IPBUF->ethhdr.src));
 }
 
 
@@ -371,16 +460,23 @@ uip_arp_out(void)
       uip_ipaddr_copy(ipaddr, IPBUF->destipaddr);
     }
       
-    for(i = 0; i < UIP_ARPTAB_SIZE; ++i) {
-      tabptr = &arp_table[i];
-      if(uip_ipaddr_cmp(ipaddr, tabptr->ipaddr)) {
-	break;
+    tabptr = uip_arp_lookup(uip_get32(ipaddr));
+
+    if(tabptr == 0) {
+      UIP_STAT(++uip_stat.arp.miss);
+#if ARP_PARK_SUPPORT == 1
+      /* The destination address was not in our ARP table. Park the IP
+         packet in the ENC28J60 until the ARP reply arrives, the
+         destination address is filled in then. */
+      memcpy(IPBUF->ethhdr.src.addr, uip_ethaddr.addr, 6);
+      IPBUF->ethhdr.type = HTONS(UIP_ETHTYPE_IP);
+      if(Enc28j60Park(uip_buf, (uint16_t)(uip_len + sizeof(struct uip_eth_hdr)))) {
+        uip_ipaddr_copy(park_ipaddr, ipaddr);
+        park_time = arptime;
       }
-    }
+#endif /* ARP_PARK_SUPPORT == 1 */
 
-    if(i == UIP_ARPTAB_SIZE) {
-      /* The destination address was not in our ARP table, so we
-	 overwrite the IP packet with an ARP request. */
+      /* Overwrite the IP packet with an ARP request. */
 
       memset(BUF->ethhdr.dest.addr, 0xff, 6);
       memset(BUF->dhwaddr.addr, 0x00, 6);
@@ -402,6 +498,8 @@ uip_arp_out(void)
       return;
     }
 
+    UIP_STAT(++uip_stat.arp.hit);
+
     /* Build an ethernet header. */
     memcpy(IPBUF->ethhdr.dest.addr, tabptr->ethaddr.addr, 6);
   }
@@ -411,3 +509,84 @@ uip_arp_out(void)
 
   uip_len += sizeof(struct uip_eth_hdr);
 }
+
+
+#if UIP_ARP_ANNOUNCE > 0
+/*-----------------------------------------------------------------------------------*/
+/**
+ * Start announcing our IP and MAC address.
+ *
+ * Should be called once the IP and MAC address are set up, at startup and
+ * after an address change, so hosts on the local network replace any stale
+ * ARP table entry for our IP address right away. UIP_ARP_ANNOUNCE
+ * gratuitous ARP requests are sent by uip_arp_announce(), the first one
+ * immediately and then with a doubling delay starting at one periodic timer
+ * tick (0.5, 1, 2, ... seconds).
+ */
+/*-----------------------------------------------------------------------------------*/
+void
+uip_arp_announce_start(void)
+{
+  announce_count = UIP_ARP_ANNOUNCE;
+  announce_wait = 0;
+  announce_backoff = 1;
+}
+
+
+/*-----------------------------------------------------------------------------------*/
+/**
+ * Count down to the next ARP announcement. Should be called on every
+ * periodic timer tick.
+ */
+/*-----------------------------------------------------------------------------------*/
+void
+uip_arp_announce_timer(void)
+{
+  if(announce_wait != 0) {
+    --announce_wait;
+  }
+}
+
+
+/*-----------------------------------------------------------------------------------*/
+/**
+ * Build the next ARP announcement if one is due.
+ *
+ * If an announcement is due it is placed in the uip_buf[] buffer and its
+ * length in uip_len, otherwise uip_len is set to 0. The announcement is an
+ * ARP request for our own IP address with our IP address as the sender
+ * (RFC 5227).
+ */
+/*-----------------------------------------------------------------------------------*/
+void
+uip_arp_announce(void)
+{
+  uip_len = 0;
+  if(announce_count == 0 || announce_wait != 0) {
+    return;
+  }
+  --announce_count;
+  announce_wait = announce_backoff;
+  announce_backoff = (uint8_t)(announce_backoff << 1);
+
+  if((uip_hostaddr[0] | uip_hostaddr[1]) == 0) {
+    return;
+  }
+
+  memset(BUF->ethhdr.dest.addr, 0xff, 6);
+  memset(BUF->dhwaddr.addr, 0x00, 6);
+  memcpy(BUF->ethhdr.src.addr, uip_ethaddr.addr, 6);
+  memcpy(BUF->shwaddr.addr, uip_ethaddr.addr, 6);
+
+  uip_ipaddr_copy(BUF->dipaddr, uip_hostaddr);
+  uip_ipaddr_copy(BUF->sipaddr, uip_hostaddr);
+  BUF->opcode = HTONS(ARP_REQUEST); /* ARP request. */
+  BUF->hwtype = HTONS(ARP_HWTYPE_ETH);
+  BUF->protocol = HTONS(UIP_ETHTYPE_IP);
+  BUF->hwlen = 6;
+  BUF->protolen = 4;
+  BUF->ethhdr.type = HTONS(UIP_ETHTYPE_ARP);
+
+  uip_len = sizeof(struct arp_hdr);
+}
+#endif /* UIP_ARP_ANNOUNCE > 0 */
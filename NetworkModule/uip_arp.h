@@ -95,8 +95,7 @@ void uip_arp_init(void);
    inserts a new mapping if none exists. The function assumes that an
    IP packet with an Ethernet header is present in the uip_buf buffer
    and that the length of the packet is in the uip_len variable. */
-/*void uip_arp_ipin(void);*/
-#define uip_arp_ipin()
+void uip_arp_ipin(void);
 
 /* The uip_arp_arpin() should be called when an ARP packet is received
    by the Ethernet driver. This function also assumes that the
@@ -113,15 +112,27 @@ void uip_arp_arpin(void);
    address filled in if an ARP table entry for the destination IP
    address (or the IP address of the default router) is present. If no
    such table entry is found, the IP packet is overwritten with an ARP
-   request and we rely on TCP to retransmit the packet that was
-   overwritten. In any case, the uip_len variable holds the length of
-   the Ethernet frame that should be transmitted. */
+   request. With ARP_PARK_SUPPORT the IP packet is first parked in the
+   ENC28J60 and sent when the ARP reply arrives, otherwise we rely on TCP
+   to retransmit the packet that was overwritten. In any case, the uip_len
+   variable holds the length of the Ethernet frame that should be
+   transmitted. */
 void uip_arp_out(void);
 
 /* The uip_arp_timer() function should be called every ten seconds. It
    is responsible for flushing old entries in the ARP table. */
 void uip_arp_timer(void);
 
+/* Gratuitous ARP announcements of our own IP and MAC address
+   (UIP_ARP_ANNOUNCE > 0). uip_arp_announce_start() should be called when
+   the addresses have been set up, uip_arp_announce_timer() on every periodic
+   timer tick and uip_arp_announce() on every pass of the main loop. When
+   uip_arp_announce() returns, the contents of the uip_buf buffer should be
+   sent out on the Ethernet if the uip_len variable is > 0. */
+void uip_arp_announce_start(void);
+void uip_arp_announce_timer(void);
+void uip_arp_announce(void);
+
 
 /**
  * Specifiy the Ethernet MAC address.
@@ -111,9 +111,23 @@
 #define UIP_LISTENPORTS 5
 
 
-// The initial retransmission timeout counted in timer pulses.
-// This should not be changed.
-#define UIP_RTO         3
+// The number of entries in the hash index used to find the connection of an
+// incoming TCP segment. Each entry takes 1 byte of RAM. Must be a power of 2.
+// Should be at least UIP_CONNS when UIP_CONNS is raised.
+#define UIP_CONNHASH_SIZE 8
+
+
+// The initial retransmission timeout in milliseconds, used until the round
+// trip time of a connection has been measured (RFC 6298).
+#define UIP_RTO         1000
+
+
+// Limits of the retransmission timeout in milliseconds. The lower limit
+// covers the delayed ACK of the remote host (up to 200ms on Windows) while
+// its round trip time is not known yet. The upper limit also caps the
+// exponential backoff and must be below 32768.
+#define UIP_RTO_MIN     250
+#define UIP_RTO_MAX     16000
 
 
 // The maximum number of times a segment should be retransmitted before the
@@ -144,20 +158,69 @@
 #define UIP_TIME_WAIT_TIMEOUT 120
 
 
+// How long a connection closed by this side stays in TIME_WAIT, in periodic
+// timer ticks (512ms). The web server closes every connection after its
+// response, so each request leaves one in TIME_WAIT. When a SYN finds no
+// free connection the oldest one in TIME_WAIT (then in FIN_WAIT_2) is
+// reused regardless, so a full table of TIME_WAIT connections does not drop
+// SYNs (tools/tcp_load_test.sh checks this with up to UIP_CONNS pollers).
+// Leaving early frees connections without waiting for a SYN, but if the
+// last ACK is lost the remote host's repeated FIN gets a RST instead of an
+// ACK, and a delayed segment of the old connection is no longer recognised
+// as such. The default keeps the full TIME_WAIT.
+// 0 = Stay for UIP_TIME_WAIT_TIMEOUT
+// 1 to UIP_TIME_WAIT_TIMEOUT = Stay that many ticks
+#define UIP_TIME_WAIT_SHORT 0
+
+
 /*------------------------------------------------------------------------------*/
 // ARP configuration options
 /*------------------------------------------------------------------------------*/
 
 // The size of the ARP table. This option should be set to a larger value if
-// this uIP node will have many connections from the local network.
+// this uIP node will have many connections from the local network. The table
+// is hashed on the low bytes of the IP address, so the size must be a power
+// of 2. Each entry takes 11 bytes of RAM, which comes out of the stack
+// headroom, so check the .bss end in the map file before raising it.
+// A node talking to more hosts than it has entries keeps evicting and
+// re-resolving them: 15 hosts need 16 entries (176 bytes, 88 more than the
+// default). The default stays at 8 because the stack headroom for 16 has not
+// been confirmed from a map of the current build. The checked in
+// NetworkModule.map predates the TCP window, statistics and page cache
+// additions and shows .bss ending at 0x5c1 with the stack at 0x7ff.
 #define UIP_ARPTAB_SIZE 8
 
 
+// The number of ARP table slots, starting at the hashed slot, that an entry
+// can be stored in. A larger value means fewer evictions when addresses hash
+// to the same slot, but longer lookups. Must not be larger than
+// UIP_ARPTAB_SIZE.
+#define UIP_ARP_PROBES 4
+
+
+// The number of gratuitous ARP announcements sent at startup and after an
+// IP or MAC address change, so other hosts update their ARP tables at once.
+// They are sent 0, 0.5, 1.5, 3.5, ... seconds after the start.
+// 0 = No announcements
+#define UIP_ARP_ANNOUNCE 4
+
+
 // The maxium age of ARP table entries measured in 10ths of seconds. A
 // UIP_ARP_MAXAGE of 120 corresponds to 20 minutes (BSD default).
 #define UIP_ARP_MAXAGE 120
 
 
+// Determines if an IP packet that misses in the ARP table is parked in a
+// spare ENC28J60 TX slot while the ARP request goes out, and sent as soon as
+// the ARP reply arrives. Without it the packet is overwritten by the ARP
+// request and only goes out when TCP retransmits it. A parked packet that
+// gets no ARP reply is dropped after 10 to 20 seconds. Needs at least 2 TX
+// slots (ENC28J60_TX_PARTITION).
+// 0 = Packet is dropped on an ARP miss
+// 1 = Packet is parked on an ARP miss
+#define ARP_PARK_SUPPORT 1
+
+
 /*------------------------------------------------------------------------------*/
 // General configuration options
 /*------------------------------------------------------------------------------*/
@@ -190,6 +253,77 @@
 #define UIP_BYTE_ORDER     UIP_BIG_ENDIAN
 
 
+// Determines if the TCP checksum of outgoing segments is computed by the
+// ENC28J60 DMA checksum engine instead of by the CPU. The frame is copied to
+// the ENC28J60 with a zero checksum which is then computed in the ENC28J60
+// transmit buffer and patched in place. Incoming segments are still verified
+// in software. Reception is held off for the few microseconds the DMA runs
+// (ENC28J60 errata B7), so an incoming frame may occasionally be missed.
+// With the software checksum the web server sums the page data while it
+// renders it and adds the few bytes of HTTP header and chunk framing, so uIP
+// only sums the TCP/IP headers of the segments it sends.
+// The DMA checksum leaves the CPU nothing to sum for outgoing segments, so
+// the web server does not keep that sum.
+// 0 = Software TCP checksum
+// 1 = ENC28J60 DMA TCP checksum for outgoing segments
+#define UIP_ARCH_CHKSUM  1
+
+
+// Determines if the software checksum (incoming segments, the IP header and,
+// with UIP_ARCH_CHKSUM == 0, outgoing segments) uses the STM8 assembly kernel
+// in uip.c. The portable C loop is the reference for it; tools/chksum_test.c
+// compares the two on the host.
+// 0 = Portable C checksum
+// 1 = STM8 assembly checksum
+#define UIP_ASM_CHKSUM  1
+
+
+// Determines if the byte by byte uip_add32() and uip_acc32 are built. The TCP
+// sequence numbers in struct uip_conn are uint32_t and use the compiler's
+// native 32 bit arithmetic, so uIP itself does not need uip_add32().
+// 0 = Include uip_add32() and uip_acc32
+// 1 = Native 32 bit arithmetic only
+#define UIP_ARCH_ADD32  1
+
+
+// Determines if a TCP data segment that times out is retransmitted straight
+// from the ENC28J60 transmit buffer. Each TX slot remembers the connection,
+// sequence number and length of the data segment it holds. If the segment
+// is still in a slot and the ack number is unchanged the slot is simply
+// queued again; otherwise the application rebuilds the data as before.
+// 0 = Application always rebuilds retransmitted data
+// 1 = Retransmit from the ENC28J60 transmit buffer when possible
+#define UIP_REXMIT_CACHE  1
+
+
+// The number of TCP data segments a connection may have in flight. With more
+// than 1 each segment is kept (pinned) in its ENC28J60 TX slot until it is
+// acknowledged and is retransmitted from there, so the application never has
+// to rebuild more than one segment. One TX slot always stays free for other
+// frames, so a window of N segments needs N + 1 TX slots
+// (ENC28J60_TX_PARTITION). While no slot can be pinned a connection sends one
+// segment at a time as before. With the default 2KB TX buffer this means one
+// segment in flight; set the TX buffer to 3KB or more on the Address Settings
+// page to get the window.
+// 1 = Stop-and-wait, one segment in flight
+// 2 or 3 = Up to that many segments in flight
+#define UIP_TCP_WINDOW  2
+#if UIP_TCP_WINDOW > 1 && UIP_REXMIT_CACHE != 1
+#error "UIP_TCP_WINDOW > 1 requires UIP_REXMIT_CACHE == 1"
+#endif
+
+
+// How long in milliseconds the ACK of received data is held back when the
+// application has nothing to send in reply. If the application sends data
+// before then the ACK rides on that segment, otherwise a pure ACK is sent
+// when the delay runs out or a second data segment arrives (RFC 1122). An
+// HTTP request that spans several segments then costs fewer frames. Keep it
+// well below the 200ms minimum retransmission timeout of common hosts.
+// 0 = ACK at once
+// 1 to 200 = Delay the ACK that many milliseconds
+#define UIP_ACK_DELAY  50
+
+
 /*------------------------------------------------------------------------------*/
 /**
  * Application specific compile controls
@@ -220,6 +354,113 @@
 #define GPIO_SUPPORT  1
 
 
+// Determines how the ENC28J60 SPI interface is driven. The standard module
+// has the ENC28J60 wired to pins that are not the STM8 SPI peripheral pins, so
+// the interface must be bit banged. Modules that are rewired to put the
+// ENC28J60 SCK/SI/SO on PC5/PC6/PC7 can use the hardware SPI peripheral at
+// 8MHz instead. Rewired modules lose the Relay 8 and Relay 16 outputs.
+// The host mock is only for building the ENC28J60 driver into a Linux test
+// (tools/enc28j60_test.sh); it does not drive any pins.
+// 1 = Bit bang SPI on PC2/PC3/PC4
+// 2 = Hardware SPI on PC5/PC6/PC7
+// 3 = Host mock transport
+#define SPI_SUPPORT  1
+
+
+// Determines how the main loop finds out that the ENC28J60 has received a
+// packet. Polling reads the ENC28J60 packet counter over SPI on every pass of
+// the main loop. With the interrupt option the ENC28J60 -INT output (PC5)
+// triggers a Port C interrupt and the ENC28J60 is only read when a packet is
+// waiting. -INT is PC5 which is the SCK pin when SPI_SUPPORT == 2, so the
+// interrupt option can't be used with hardware SPI.
+// 0 = Poll the ENC28J60 packet counter
+// 1 = Use the ENC28J60 -INT interrupt
+#define RX_INTERRUPT_SUPPORT  1
+#if SPI_SUPPORT == 2 && RX_INTERRUPT_SUPPORT == 1
+#error "RX_INTERRUPT_SUPPORT requires PC5, which is SCK when SPI_SUPPORT == 2"
+#endif
+
+
+// Determines which frames the ENC28J60 receive filters accept. Every frame
+// accepted has to be at least partly read over SPI, so on a busy network
+// rejecting broadcasts in the ENC28J60 saves considerable SPI and CPU time.
+// The pattern match filter is programmed with our IP address, so it is
+// reprogrammed whenever the ENC28J60 is re-initialized for an IP change.
+// No multicast groups are used, so the hash table filter is left disabled.
+// 0 = Unicast to our MAC plus all broadcasts
+// 1 = Unicast to our MAC plus only broadcast ARP requests for our IP address
+#define RX_FILTER_SUPPORT  1
+
+
+// ENC28J60 link and buffer defaults. These are used for a new device and
+// after a factory reset; afterwards the values stored in EEPROM are used,
+// and both are changed on the Address Settings page. Changing them here does
+// not affect a device that already has a stored setting.
+// Duplex mode. The ENC28J60 does not autonegotiate, so full duplex should
+// only be used with a switch port that is also set to full duplex.
+// 0 = Half duplex
+// 1 = Full duplex
+#define ENC28J60_FULL_DUPLEX  0
+
+// Split of the ENC28J60's 8KB buffer memory, given as the number of 1KB
+// TX slots. A big RX buffer absorbs bursts of incoming frames, more TX
+// slots let more responses be queued without waiting for the wire, and
+// UIP_TCP_WINDOW needs one more TX slot than the segments it keeps in flight.
+// The default keeps the 6KB RX buffer of earlier versions, so bursts of
+// incoming frames are absorbed as before and UIP_TCP_WINDOW only takes
+// effect with 3 or more TX slots. 3 trades 1KB of RX buffer, about 2 full
+// size frames of a burst, for a 2 segment window. A device keeps the value
+// it has stored in EEPROM; it is changed on the Address Settings page.
+// 1 = 7KB RX / 1KB TX
+// 2 = 6KB RX / 2KB TX
+// 3 = 5KB RX / 3KB TX
+// 4 = 4KB RX / 4KB TX
+#define ENC28J60_TX_PARTITION  2
+
+// Determines if rendered web pages are cached in ENC28J60 buffer memory.
+// A page is rendered once into the cache and then sent from there with the
+// ENC28J60 DMA copy engine until the IO states change or a POST is received.
+// The cache takes PAGE_CACHE_SIZE KB from the RX buffer, and only pages
+// whose template fits are cached. The cache holds one page at a time, so it
+// pays off for the page that is polled. If the cache does not leave at least
+// 1KB RX buffer it is not used. PAGE_CACHE_SIZE needed per page:
+//   1KB: Short relay state page (/99)
+//   3KB: IO page with GPIO_SUPPORT 3
+//   5KB: IO page with GPIO_SUPPORT 2, Address Settings page
+//   6KB: IO page with GPIO_SUPPORT 1, needs ENC28J60_TX_PARTITION 1
+// The Network Statistics page is never cached. The default of 1 only serves
+// pollers of the short relay state page and leaves the RX buffer and TX
+// slots as they are; the IO page of the default GPIO_SUPPORT 1 build is
+// rendered on every request unless the buffer split is changed.
+// Requires UIP_ARCH_CHKSUM == 1 as the payload never passes the CPU.
+// 0 = No page cache
+// 1 = Page cache
+#define PAGE_CACHE_SUPPORT  1
+#define PAGE_CACHE_SIZE  1
+#if PAGE_CACHE_SUPPORT == 1 && UIP_ARCH_CHKSUM != 1
+#error "PAGE_CACHE_SUPPORT requires UIP_ARCH_CHKSUM == 1"
+#endif
+
+// Determines if HTTP/1.1 persistent connections (keep-alive) are supported.
+// The connection is then kept open after a response for the next request
+// instead of being closed, which saves clients that poll the connection
+// setup, the FIN handshake and a TIME_WAIT connection per request. Only
+// HTTP/1.1 GET requests are kept alive. Pages from the page cache are sent
+// with their exact Content-Length; rendered pages, whose length is only
+// known once they are rendered, are sent in chunks (Transfer-Encoding
+// chunked). A kept connection is closed after HTTP_KEEPALIVE_MAX requests,
+// or when it has waited HTTP_KEEPALIVE_IDLE periodic timer ticks (512ms)
+// for the next request. A request that arrives while a response is still
+// being sent is not acknowledged, so the client sends it again after its
+// retransmission timeout and it is answered then (counted as deferred on
+// the Network Statistics page).
+// 0 = Close the connection after each response
+// 1 = Keep-alive
+#define HTTP_KEEPALIVE_SUPPORT  1
+#define HTTP_KEEPALIVE_MAX  100
+#define HTTP_KEEPALIVE_IDLE  10
+
+
 /*------------------------------------------------------------------------------*/
 /**
  * Appication specific configurations
@@ -0,0 +1,668 @@
+/*
+ * Host test for the ENC28J60 driver (NetworkModule/Enc28j60.c).
+ *
+ * The driver is built with SPI_SUPPORT == 3, so Spi.c hands every -CS edge
+ * and every SPI byte to SpiMockSelect() / SpiMockTransfer() below. These
+ * decode the ENC28J60 SPI instruction set (RCR, WCR, BFS, BFC, RBM, WBM and
+ * SRC) against a model of the chip: the 8KB buffer memory, the banked
+ * control registers, the PHY registers behind the MII interface, the
+ * receive ring, transmission and the DMA copy / checksum engine. Frames are
+ * transmitted as soon as TXRTS is set and all DMA operations complete
+ * immediately. The datasheet only documents BFS and BFC for the ETH
+ * registers, but the driver has always used them on MACON3, MACON4 and
+ * MICMD as well, so the model applies them to any register.
+ *
+ * Build and run with tools/enc28j60_test.sh.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "uipopt.h"
+#include "uip.h"
+#include "Enc28j60.h"
+
+
+/*---------------------------------------------------------------------------*/
+/* Everything the driver needs from the rest of the firmware */
+volatile uint8_t PC_ODR;
+volatile uint8_t PC_IDR = 0x20;
+volatile uint8_t PC_DDR;
+volatile uint8_t PC_CR1;
+volatile uint8_t PC_CR2;
+volatile uint8_t PE_ODR;
+volatile uint8_t EXTI_CR1;
+
+uint8_t uip_ethaddr1 = 0xc2;
+uint8_t uip_ethaddr2 = 0x4d;
+uint8_t uip_ethaddr3 = 0x69;
+uint8_t uip_ethaddr4 = 0x6b;
+uint8_t uip_ethaddr5 = 0x65;
+uint8_t uip_ethaddr6 = 0x00;
+uip_ipaddr_t uip_hostaddr;
+struct uip_stats uip_stat;
+uint8_t enc28j60_config;
+
+void spi_init(void);
+
+void wait_timer(uint16_t wait)
+{
+  (void)wait;
+}
+
+/* Driver state checked by the tests */
+extern uint16_t nRxEnd;
+extern uint16_t nTxStart;
+extern uint8_t nTxSlots;
+extern uint8_t nCurrentBank;
+
+
+/*---------------------------------------------------------------------------*/
+/* ENC28J60 model */
+
+/* Register addresses (datasheet table 3-2) */
+#define M_EIE       0x1B
+#define M_EIR       0x1C
+#define M_ESTAT     0x1D
+#define M_ECON2     0x1E
+#define M_ECON1     0x1F
+
+#define M_ERDPT     0x00  /* Bank 0 */
+#define M_EWRPT     0x02
+#define M_ETXST     0x04
+#define M_ETXND     0x06
+#define M_ERXST     0x08
+#define M_ERXND     0x0A
+#define M_ERXRDPT   0x0C
+#define M_ERXWRPT   0x0E
+#define M_EDMAST    0x10
+#define M_EDMAND    0x12
+#define M_EDMADST   0x14
+#define M_EDMACS    0x16
+#define M_EPKTCNT   0x19  /* Bank 1 */
+#define M_MACON3    0x02  /* Bank 2 */
+#define M_MICMD     0x12
+#define M_MIREGADR  0x14
+#define M_MIWR      0x16
+#define M_MIRD      0x18
+#define M_MISTAT    0x0A  /* Bank 3 */
+
+#define M_ECON1_TXRTS   0x08
+#define M_ECON1_CSUMEN  0x10
+#define M_ECON1_DMAST   0x20
+#define M_ECON1_RXEN    0x04
+#define M_ECON2_PKTDEC  0x40
+#define M_EIE_INTIE     0x80
+#define M_EIE_PKTIE     0x40
+
+#define M_PHCON1        0x00
+#define M_PHCON1_PRST   0x8000
+
+#define M_TXLOG         16
+
+static uint8_t Mem[8192];
+static uint8_t Reg[4][0x20];  /* 0x1B-0x1F are only kept in bank 0 */
+static uint16_t Phy[0x20];
+static uint8_t Selected;
+static uint8_t Opcode;
+static uint16_t Count;
+
+static uint8_t TxLog[M_TXLOG][ENC28J60_MAXFRAME];
+static uint16_t TxLogLen[M_TXLOG];
+static unsigned TxFrames;
+
+static unsigned Checks;
+static unsigned Failures;
+
+#define CHECK(cond) do { \
+  Checks++; \
+  if (!(cond)) { \
+    Failures++; \
+    printf("%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+  } } while (0)
+
+
+static uint8_t* ModelReg(uint8_t nAddr)
+{
+  if (nAddr >= M_EIE) return &Reg[0][nAddr];
+  return &Reg[Reg[0][M_ECON1] & 0x03][nAddr];
+}
+
+
+static uint16_t ModelGet16(uint8_t nBank, uint8_t nAddr)
+{
+  return (uint16_t)(Reg[nBank][nAddr] | (Reg[nBank][nAddr + 1] << 8));
+}
+
+
+static void ModelSet16(uint8_t nBank, uint8_t nAddr, uint16_t nValue)
+{
+  Reg[nBank][nAddr] = (uint8_t)nValue;
+  Reg[nBank][nAddr + 1] = (uint8_t)(nValue >> 8);
+}
+
+
+static void ModelReset(void)
+{
+  memset(Reg, 0, sizeof(Reg));
+  Reg[0][M_ESTAT] = 0x01;  /* CLKRDY */
+  Reg[0][M_ECON2] = 0x80;  /* AUTOINC */
+  ModelSet16(0, M_ERXND, 0x1FFF);
+}
+
+
+/* -INT is low while frames are pending and the interrupt is enabled */
+static void ModelInt(void)
+{
+  if (Reg[1][M_EPKTCNT] != 0
+   && (Reg[0][M_EIE] & (M_EIE_INTIE | M_EIE_PKTIE)) == (M_EIE_INTIE | M_EIE_PKTIE)) {
+    PC_IDR &= (uint8_t)~0x20;
+  }
+  else PC_IDR |= 0x20;
+}
+
+
+static void ModelTransmit(void)
+{
+  uint16_t nStart;
+  uint16_t nLen;
+
+  /* ETXST is the per packet control byte, ETXND the last byte */
+  nStart = ModelGet16(0, M_ETXST);
+  nLen = (uint16_t)(ModelGet16(0, M_ETXND) - nStart);
+  CHECK(nLen <= ENC28J60_MAXFRAME && nStart + 1 + nLen <= sizeof(Mem));
+  if (nLen <= ENC28J60_MAXFRAME && TxFrames < M_TXLOG) {
+    memcpy(TxLog[TxFrames], &Mem[nStart + 1], nLen);
+    TxLogLen[TxFrames] = nLen;
+  }
+  TxFrames++;
+  Reg[0][M_ECON1] &= (uint8_t)~M_ECON1_TXRTS;
+}
+
+
+static void ModelDma(void)
+{
+  uint16_t nStart;
+  uint16_t nEnd;
+  uint16_t nDest;
+  uint32_t nSum;
+  uint16_t i;
+
+  nStart = ModelGet16(0, M_EDMAST);
+  nEnd = ModelGet16(0, M_EDMAND);
+  CHECK(nStart <= nEnd && nEnd < sizeof(Mem));
+  if (Reg[0][M_ECON1] & M_ECON1_CSUMEN) {
+    nSum = 0;
+    for (i = nStart; i <= nEnd; i += 2) {
+      nSum += (uint32_t)Mem[i] << 8;
+      if (i + 1 <= nEnd) nSum += Mem[i + 1];
+    }
+    while (nSum >> 16) nSum = (nSum & 0xffff) + (nSum >> 16);
+    ModelSet16(0, M_EDMACS, (uint16_t)~nSum);
+  }
+  else {
+    nDest = ModelGet16(0, M_EDMADST);
+    CHECK(nDest + (nEnd - nStart) < sizeof(Mem));
+    memmove(&Mem[nDest], &Mem[nStart], (size_t)(nEnd - nStart + 1));
+  }
+  Reg[0][M_ECON1] &= (uint8_t)~M_ECON1_DMAST;
+}
+
+
+/* Side effects of a control register write */
+static void ModelWritten(uint8_t nAddr)
+{
+  uint8_t nBank;
+
+  nBank = (uint8_t)(nAddr >= M_EIE ? 0 : Reg[0][M_ECON1] & 0x03);
+
+  if (nBank == 0 && (nAddr == M_ERXST || nAddr == M_ERXST + 1)) {
+    /* Writing ERXST also moves ERXWRPT */
+    ModelSet16(0, M_ERXWRPT, ModelGet16(0, M_ERXST));
+  }
+  if (nBank == 2 && nAddr == M_MIWR + 1) {
+    /* Writing MIWRH starts the PHY write; a PHY reset completes at once */
+    Phy[Reg[2][M_MIREGADR] & 0x1F] = ModelGet16(2, M_MIWR);
+    Phy[M_PHCON1] &= (uint16_t)~M_PHCON1_PRST;
+  }
+  if (nBank == 2 && nAddr == M_MICMD && (Reg[2][M_MICMD] & 0x01)) {
+    ModelSet16(2, M_MIRD, Phy[Reg[2][M_MIREGADR] & 0x1F]);
+  }
+  if (nAddr == M_ECON2 && (Reg[0][M_ECON2] & M_ECON2_PKTDEC)) {
+    if (Reg[1][M_EPKTCNT]) Reg[1][M_EPKTCNT]--;
+    Reg[0][M_ECON2] &= (uint8_t)~M_ECON2_PKTDEC;
+  }
+  if (nAddr == M_ECON1 && (Reg[0][M_ECON1] & M_ECON1_DMAST)) ModelDma();
+  if (nAddr == M_ECON1 && (Reg[0][M_ECON1] & M_ECON1_TXRTS)) ModelTransmit();
+}
+
+
+void SpiMockSelect(uint8_t nSelect)
+{
+  CHECK(!(nSelect && Selected));
+  Selected = nSelect;
+  Count = 0;
+  ModelInt();
+}
+
+
+uint8_t SpiMockTransfer(uint8_t nByte)
+{
+  uint8_t nAddr;
+  uint8_t nBank;
+  uint8_t nDummy;
+  uint8_t nOut;
+  uint16_t nPtr;
+
+  CHECK(Selected);
+  if (Count++ == 0) {
+    Opcode = nByte;
+    if (Opcode == 0xFF) ModelReset();
+    return 0;
+  }
+
+  nAddr = (uint8_t)(Opcode & 0x1F);
+  nBank = (uint8_t)(nAddr >= M_EIE ? 0 : Reg[0][M_ECON1] & 0x03);
+  nOut = 0;
+
+  switch (Opcode & 0xE0) {
+  case 0x00:  /* RCR. MAC and MII registers send a dummy byte first. */
+    nDummy = (uint8_t)((nBank == 2 && nAddr < M_EIE)
+                    || (nBank == 3 && (nAddr <= 0x05 || nAddr == M_MISTAT)));
+    CHECK(Count <= 2 + nDummy);
+    if (Count == 2 + nDummy) nOut = *ModelReg(nAddr);
+    break;
+  case 0x20:  /* RBM. The read pointer wraps at the end of the RX ring. */
+    CHECK(Opcode == 0x3A);
+    nPtr = ModelGet16(0, M_ERDPT);
+    nOut = Mem[nPtr];
+    if (nPtr == ModelGet16(0, M_ERXND)) nPtr = ModelGet16(0, M_ERXST);
+    else nPtr = (uint16_t)((nPtr + 1) & 0x1FFF);
+    ModelSet16(0, M_ERDPT, nPtr);
+    break;
+  case 0x40:  /* WCR */
+    CHECK(Count == 2);
+    *ModelReg(nAddr) = nByte;
+    ModelWritten(nAddr);
+    break;
+  case 0x60:  /* WBM */
+    CHECK(Opcode == 0x7A);
+    nPtr = ModelGet16(0, M_EWRPT);
+    Mem[nPtr] = nByte;
+    ModelSet16(0, M_EWRPT, (uint16_t)((nPtr + 1) & 0x1FFF));
+    break;
+  case 0x80:  /* BFS */
+    CHECK(Count == 2);
+    *ModelReg(nAddr) |= nByte;
+    ModelWritten(nAddr);
+    break;
+  case 0xA0:  /* BFC */
+    CHECK(Count == 2);
+    *ModelReg(nAddr) &= (uint8_t)~nByte;
+    ModelWritten(nAddr);
+    break;
+  default:
+    CHECK(0);
+    break;
+  }
+  return nOut;
+}
+
+
+/* Writes a received frame into the RX ring the way the ENC28J60 does:
+   next packet pointer, receive status vector, frame, CRC, padded to an
+   even address. Returns 0 if reception is disabled or the ring is full. */
+static uint8_t ModelReceive(const uint8_t* pFrame, uint16_t nLen, uint8_t nOk)
+{
+  uint16_t nStart;
+  uint16_t nEnd;
+  uint16_t nWr;
+  uint16_t nNext;
+  uint16_t nTotal;
+  uint16_t nFree;
+  uint8_t Head[6];
+  uint16_t i;
+
+  if (!(Reg[0][M_ECON1] & M_ECON1_RXEN)) return 0;
+
+  nStart = ModelGet16(0, M_ERXST);
+  nEnd = ModelGet16(0, M_ERXND);
+  nWr = ModelGet16(0, M_ERXWRPT);
+  nTotal = (uint16_t)(6 + nLen + 4);
+  nTotal = (uint16_t)(nTotal + (nTotal & 1));
+
+  /* Free space up to ERXRDPT, which trails the data still to be read */
+  nFree = (uint16_t)(ModelGet16(0, M_ERXRDPT) - nWr);
+  if (ModelGet16(0, M_ERXRDPT) < nWr) nFree = (uint16_t)(nFree + nEnd - nStart + 1);
+  if (nTotal >= nFree) return 0;
+
+  nNext = (uint16_t)(nWr + nTotal);
+  if (nNext > nEnd) nNext = (uint16_t)(nNext - (nEnd - nStart + 1));
+
+  Head[0] = (uint8_t)nNext;
+  Head[1] = (uint8_t)(nNext >> 8);
+  Head[2] = (uint8_t)(nLen + 4);
+  Head[3] = (uint8_t)((nLen + 4) >> 8);
+  Head[4] = (uint8_t)(nOk ? 0x80 : 0x00);  /* Bit 23, Received Ok */
+  Head[5] = 0;
+
+  for (i = 0; i < nTotal; i++) {
+    if (i < 6) Mem[nWr] = Head[i];
+    else if (i < 6 + nLen) Mem[nWr] = pFrame[i - 6];
+    else Mem[nWr] = 0xCC;  /* CRC and padding */
+    if (nWr == nEnd) nWr = nStart;
+    else nWr++;
+  }
+  ModelSet16(0, M_ERXWRPT, nNext);
+
+  Reg[1][M_EPKTCNT]++;
+#if RX_INTERRUPT_SUPPORT == 1
+  /* Falling edge of -INT */
+  if (PC_IDR & 0x20) enc28j60_rx_pending = 1;
+#endif /* RX_INTERRUPT_SUPPORT == 1 */
+  ModelInt();
+  return 1;
+}
+
+
+/*---------------------------------------------------------------------------*/
+/* Test frames */
+static const uint8_t HostIp[4] = { 192, 168, 1, 4 };
+static const uint8_t PeerIp[4] = { 192, 168, 1, 20 };
+
+static uint16_t Sum16(uint32_t nSum, const uint8_t* pData, uint16_t nLen)
+{
+  uint16_t i;
+
+  for (i = 0; i + 1 < nLen; i += 2) nSum += (uint32_t)((pData[i] << 8) | pData[i + 1]);
+  if (nLen & 1) nSum += (uint32_t)(pData[nLen - 1] << 8);
+  while (nSum >> 16) nSum = (nSum & 0xffff) + (nSum >> 16);
+  return (uint16_t)nSum;
+}
+
+
+/* Builds an Ethernet / IPv4 / TCP frame with nData bytes of payload and a
+   zero TCP checksum. Returns the frame length. */
+static uint16_t MakeTcpFrame(uint8_t* pFrame, const uint8_t* pDest, uint16_t nData, uint8_t nSeed)
+{
+  uint16_t nIpLen;
+  uint16_t i;
+
+  memset(pFrame, 0, 54);
+  memset(&pFrame[0], 0x02, 6);
+  pFrame[6] = uip_ethaddr1;
+  pFrame[7] = uip_ethaddr2;
+  pFrame[8] = uip_ethaddr3;
+  pFrame[9] = uip_ethaddr4;
+  pFrame[10] = uip_ethaddr5;
+  pFrame[11] = uip_ethaddr6;
+  pFrame[12] = 0x08;
+  pFrame[13] = 0x00;
+
+  nIpLen = (uint16_t)(20 + 20 + nData);
+  pFrame[14] = 0x45;
+  pFrame[16] = (uint8_t)(nIpLen >> 8);
+  pFrame[17] = (uint8_t)nIpLen;
+  pFrame[22] = 64;
+  pFrame[23] = UIP_PROTO_TCP;
+  memcpy(&pFrame[26], PeerIp, 4);
+  memcpy(&pFrame[30], pDest, 4);
+
+  pFrame[34] = 0x00;  /* Source port 80 */
+  pFrame[35] = 80;
+  pFrame[36] = 0xc0;
+  pFrame[37] = nSeed;
+  pFrame[41] = nSeed;  /* Sequence number */
+  pFrame[46] = 0x50;   /* Data offset 5 words */
+  pFrame[47] = 0x18;   /* PSH ACK */
+  pFrame[48] = 0x05;
+  pFrame[49] = 0xb4;
+
+  for (i = 0; i < nData; i++) pFrame[54 + i] = (uint8_t)(nSeed + i * 7);
+  return (uint16_t)(54 + nData);
+}
+
+
+/* TCP checksum of a frame built by MakeTcpFrame */
+static uint16_t TcpChecksum(const uint8_t* pFrame)
+{
+  uint16_t nTcpLen;
+  uint32_t nSum;
+
+  nTcpLen = (uint16_t)(((pFrame[16] << 8) | pFrame[17]) - 20);
+  nSum = (uint32_t)UIP_PROTO_TCP + nTcpLen;
+  nSum = Sum16(nSum, &pFrame[26], 8);
+  nSum = Sum16(nSum, &pFrame[34], nTcpLen);
+  return (uint16_t)~nSum;
+}
+
+
+static void Init(uint8_t nConfig)
+{
+  memset(Mem, 0, sizeof(Mem));
+  memset(Phy, 0, sizeof(Phy));
+  ModelReset();
+  Selected = 0;
+  TxFrames = 0;
+  memset(&uip_stat, 0, sizeof(uip_stat));
+  memcpy(uip_hostaddr, HostIp, 4);
+  enc28j60_config = nConfig;
+
+  spi_init();
+  Enc28j60Init();
+}
+
+
+/*---------------------------------------------------------------------------*/
+/* Enc28j60Init programs the partition, duplex mode and MAC address */
+static void TestInit(void)
+{
+  uint8_t nConfig;
+  uint8_t nSlots;
+  uint8_t nFull;
+
+  for (nConfig = 0; nConfig < 0x10; nConfig++) {
+    Init(nConfig);
+
+    CHECK(enc28j60_config == Enc28j60CheckConfig(nConfig));
+    nSlots = (uint8_t)(enc28j60_config & ENC28J60_CFG_TXSLOTS);
+    nFull = (uint8_t)((enc28j60_config & ENC28J60_CFG_FULDPX) != 0);
+    CHECK(nSlots >= 1 && nSlots <= ENC28J60_TXSLOTS);
+    if (nConfig & ENC28J60_CFG_TXSLOTS && (nConfig & ENC28J60_CFG_TXSLOTS) <= ENC28J60_TXSLOTS) {
+      CHECK(enc28j60_config == nConfig);
+    }
+
+    CHECK(nTxSlots == nSlots);
+    CHECK(nTxStart == 0x2000 - nSlots * ENC28J60_TXSLOTSIZE);
+    CHECK(ModelGet16(0, M_ERXST) == ENC28J60_RXSTART);
+    CHECK(ModelGet16(0, M_ERXND) == nRxEnd);
+    CHECK(nRxEnd < nTxStart && (nRxEnd & 1));
+    CHECK(ModelGet16(0, M_ERXRDPT) == nRxEnd);
+
+    CHECK(((Reg[2][M_MACON3] & 0x01) != 0) == nFull);
+    CHECK(((Phy[M_PHCON1] & 0x0100) != 0) == nFull);
+
+    CHECK(Reg[3][0x04] == uip_ethaddr1);
+    CHECK(Reg[3][0x05] == uip_ethaddr2);
+    CHECK(Reg[3][0x02] == uip_ethaddr3);
+    CHECK(Reg[3][0x03] == uip_ethaddr4);
+    CHECK(Reg[3][0x00] == uip_ethaddr5);
+    CHECK(Reg[3][0x01] == uip_ethaddr6);
+
+    CHECK(Reg[0][M_ECON1] & M_ECON1_RXEN);
+    CHECK((Reg[0][M_ECON1] & 0x03) == nCurrentBank);
+    CHECK(!Selected);
+  }
+}
+
+
+/* Frames are read back intact across the wrap of the RX ring, and unwanted
+   or bad frames are dropped without returning stale data */
+static void TestReceive(void)
+{
+  static const uint8_t OtherIp[4] = { 192, 168, 1, 99 };
+  static uint8_t Frame[1100];
+  static uint8_t Buf[ENC28J60_MAXFRAME];
+  uint16_t nLen;
+  uint16_t nGot;
+  unsigned i;
+
+  Init(0);
+
+  for (i = 0; i < 60; i++) {
+    nLen = MakeTcpFrame(Frame, HostIp, (uint16_t)((i * 97) % (ENC28J60_MAXFRAME - 54)), (uint8_t)i);
+    CHECK(ModelReceive(Frame, nLen, 1));
+    memset(Buf, 0, sizeof(Buf));
+    nGot = Enc28j60Receive(Buf);
+    CHECK(nGot == nLen);
+    CHECK(memcmp(Buf, Frame, nLen) == 0);
+    CHECK(Reg[1][M_EPKTCNT] == 0);
+  }
+  CHECK(Enc28j60Receive(Buf) == 0);
+
+  /* Several frames waiting at once */
+  for (i = 0; i < 4; i++) {
+    nLen = MakeTcpFrame(Frame, HostIp, 300, (uint8_t)(0x40 + i));
+    CHECK(ModelReceive(Frame, nLen, 1));
+  }
+  for (i = 0; i < 4; i++) {
+    nLen = MakeTcpFrame(Frame, HostIp, 300, (uint8_t)(0x40 + i));
+    nGot = Enc28j60Receive(Buf);
+    CHECK(nGot == nLen);
+    CHECK(memcmp(Buf, Frame, nLen) == 0);
+  }
+  CHECK(Reg[1][M_EPKTCNT] == 0);
+
+  /* Addressed to another host */
+  nLen = MakeTcpFrame(Frame, OtherIp, 100, 1);
+  CHECK(ModelReceive(Frame, nLen, 1));
+  CHECK(Enc28j60Receive(Buf) == 0);
+  CHECK(uip_stat.eth.skipped == 1);
+
+  /* Receive error */
+  nLen = MakeTcpFrame(Frame, HostIp, 100, 2);
+  CHECK(ModelReceive(Frame, nLen, 0));
+  CHECK(Enc28j60Receive(Buf) == 0);
+  CHECK(uip_stat.eth.rxerror == 1);
+
+  /* Larger than ENC28J60_MAXFRAME */
+  nLen = MakeTcpFrame(Frame, HostIp, ENC28J60_MAXFRAME, 3);
+  CHECK(ModelReceive(Frame, nLen, 1));
+  CHECK(Enc28j60Receive(Buf) == 0);
+  CHECK(uip_stat.eth.oversize == 1);
+
+  /* Still in step afterwards */
+  nLen = MakeTcpFrame(Frame, HostIp, 200, 4);
+  CHECK(ModelReceive(Frame, nLen, 1));
+  CHECK(Enc28j60Receive(Buf) == nLen);
+  CHECK(memcmp(Buf, Frame, nLen) == 0);
+  CHECK(Reg[1][M_EPKTCNT] == 0);
+  CHECK(uip_stat.eth.rxreset == 0);
+}
+
+
+/* Frames come out of the TX slots unchanged and in order; TCP frames get
+   their checksum from the DMA when UIP_ARCH_CHKSUM == 1 */
+static void TestTransmit(void)
+{
+  static const uint8_t Arp[42] = {
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xc2, 0x4d, 0x69, 0x6b, 0x65, 0x00,
+    0x08, 0x06, 0x00, 0x01, 0x08, 0x00, 0x06, 0x04, 0x00, 0x01 };
+  static uint8_t Frame[M_TXLOG][ENC28J60_MAXFRAME];
+  uint16_t nLen[M_TXLOG];
+  uint16_t nSum;
+  unsigned i;
+
+  Init(0);
+
+  for (i = 0; i < 10; i++) {
+    if (i == 3) {
+      memcpy(Frame[i], Arp, sizeof(Arp));
+      nLen[i] = sizeof(Arp);
+    }
+    else nLen[i] = MakeTcpFrame(Frame[i], PeerIp, (uint16_t)(i * 90), (uint8_t)i);
+    Enc28j60CopyPacket(Frame[i], nLen[i]);
+    Enc28j60Send();
+  }
+  Enc28j60TxPoll();
+  Enc28j60TxPoll();
+
+  CHECK(TxFrames == 10);
+  for (i = 0; i < 10 && i < TxFrames; i++) {
+    CHECK(TxLogLen[i] == nLen[i]);
+    if (i == 3) {
+      CHECK(memcmp(TxLog[i], Frame[i], nLen[i]) == 0);
+      continue;
+    }
+    nSum = TcpChecksum(Frame[i]);
+#if UIP_ARCH_CHKSUM == 1
+    CHECK(TxLog[i][50] == (uint8_t)(nSum >> 8) && TxLog[i][51] == (uint8_t)nSum);
+#else
+    CHECK(TxLog[i][50] == 0 && TxLog[i][51] == 0);
+#endif /* UIP_ARCH_CHKSUM == 1 */
+    CHECK(memcmp(TxLog[i], Frame[i], 50) == 0);
+    CHECK(memcmp(&TxLog[i][52], &Frame[i][52], nLen[i] - 52) == 0);
+  }
+  CHECK(Reg[0][M_ECON1] & M_ECON1_RXEN);
+}
+
+
+#if PAGE_CACHE_SUPPORT == 1
+/* The payload attached from the page cache is DMA copied behind the
+   headers and the head bytes taken from the frame buffer */
+static void TestPageCache(void)
+{
+  static uint8_t Page[1024];
+  static uint8_t Frame[ENC28J60_MAXFRAME];
+  uint16_t nCache;
+  uint16_t nData;
+  uint16_t nHead;
+  uint16_t nLen;
+  uint16_t nSum;
+  uint16_t i;
+
+  Init(1);  /* One TX slot leaves room for the cache */
+  nCache = Enc28j60CacheSize();
+  CHECK(nCache == PAGE_CACHE_SIZE * 1024);
+  CHECK(nRxEnd + 1 + nCache == nTxStart);
+  if (nCache < 600) return;
+
+  for (i = 0; i < sizeof(Page); i++) Page[i] = (uint8_t)(i * 13 + 5);
+  Enc28j60CacheWrite(0, Page, nCache < sizeof(Page) ? nCache : sizeof(Page));
+
+  nHead = 9;
+  nData = 500;
+  nLen = MakeTcpFrame(Frame, PeerIp, (uint16_t)(nHead + nData), 7);
+  memcpy(&Frame[54 + nHead], &Page[100], nData);
+  nSum = TcpChecksum(Frame);
+
+  Enc28j60CacheAttach(100, nData, nHead);
+  Enc28j60CopyPacket(Frame, nLen);
+  Enc28j60Send();
+  Enc28j60TxPoll();
+
+  CHECK(TxFrames == 1);
+  CHECK(TxLogLen[0] == nLen);
+  CHECK(memcmp(TxLog[0], Frame, 50) == 0);
+  CHECK(memcmp(&TxLog[0][52], &Frame[52], nLen - 52) == 0);
+#if UIP_ARCH_CHKSUM == 1
+  CHECK(TxLog[0][50] == (uint8_t)(nSum >> 8) && TxLog[0][51] == (uint8_t)nSum);
+#endif /* UIP_ARCH_CHKSUM == 1 */
+  (void)nSum;
+}
+#endif /* PAGE_CACHE_SUPPORT == 1 */
+
+
+int main(void)
+{
+  TestInit();
+  TestReceive();
+  TestTransmit();
+#if PAGE_CACHE_SUPPORT == 1
+  TestPageCache();
+#endif /* PAGE_CACHE_SUPPORT == 1 */
+
+  printf("%u checks, %u failures\n", Checks, Failures);
+  return Failures ? 1 : 0;
+}
@@ -0,0 +1,31 @@
+#!/bin/sh
+# Builds and runs the ENC28J60 driver test on the host.
+#
+# Enc28j60.c and Spi.c are copied with the Cosmic keywords (@far etc.)
+# removed, the STM8 register headers are replaced by the stand-ins in
+# tools/host, and in the copy of uipopt.h SPI_SUPPORT is set to 3 (host
+# mock transport) and UIP_BYTE_ORDER to little endian. The other uipopt.h
+# settings are used as they are.
+#
+# Usage: sh tools/enc28j60_test.sh
+
+set -e
+
+top=$(cd "$(dirname "$0")/.." && pwd)
+out=${TMPDIR:-/tmp}/enc28j60_test
+rm -rf "$out"
+mkdir -p "$out"
+
+for f in "$top"/NetworkModule/*.c "$top"/NetworkModule/*.h; do
+  sed -e 's/@far//g; s/@interrupt//g; s/@eeprom//g; s/@tiny//g; s/@near//g' \
+    "$f" > "$out/$(basename "$f")"
+done
+cp "$top"/tools/host/*.h "$out"
+sed -i -e 's/^#define SPI_SUPPORT .*/#define SPI_SUPPORT  3/' \
+  -e 's/^#define UIP_BYTE_ORDER .*/#define UIP_BYTE_ORDER  UIP_LITTLE_ENDIAN/' "$out/uipopt.h"
+
+${CC:-cc} -std=c99 -Wall -Wno-unused-function -Wno-pointer-sign -I"$out" \
+  -o "$out/enc28j60_test" \
+  "$out/Enc28j60.c" "$out/Spi.c" "$top/tools/enc28j60_test.c"
+
+"$out/enc28j60_test"
@@ -0,0 +1,20 @@
+/*
+ * Host stand-in for the Cosmic iostm8s005.h, used by enc28j60_test.sh.
+ * The STM8 registers touched by Spi.c and Enc28j60.c are plain variables
+ * defined in enc28j60_test.c.
+ */
+
+#ifndef IOSTM8S005_H_
+#define IOSTM8S005_H_
+
+#include <stdint.h>
+
+extern volatile uint8_t PC_ODR;
+extern volatile uint8_t PC_IDR;
+extern volatile uint8_t PC_DDR;
+extern volatile uint8_t PC_CR1;
+extern volatile uint8_t PC_CR2;
+extern volatile uint8_t PE_ODR;
+extern volatile uint8_t EXTI_CR1;
+
+#endif /* IOSTM8S005_H_ */
@@ -0,0 +1,15 @@
+/*
+ * Host stand-in for stm8s-005.h, used by enc28j60_test.sh. Only the
+ * definitions Spi.c and Enc28j60.c need are provided.
+ */
+
+#ifndef STM8S_005_H_
+#define STM8S_005_H_
+
+#include "iostm8s005.h"
+
+#define EXTI_CR1_PCIS ((uint8_t)0x30)
+
+#define nop() ((void)0)
+
+#endif /* STM8S_005_H_ */
@@ -0,0 +1,689 @@
+/*
+ * Host test and benchmark for the web server (NetworkModule/httpd.c) on top
+ * of uIP (NetworkModule/uip.c).
+ *
+ * A client TCP and HTTP/1.1 model talks to the unmodified httpd.c and uip.c
+ * over a simulated 10 Mbit/s link: every frame takes its serialization time
+ * plus 50us to arrive, frames in one direction go out one after the other,
+ * nothing is lost. The server loop runs every 100us like main.c: received
+ * frames go to uip_input, the retransmission timer is checked for every
+ * connection and the periodic timer runs every 512ms. The time the STM8
+ * needs to render pages and move frames over SPI is not modelled, so the
+ * polls per second are an upper bound set by the protocol and the link.
+ *
+ * The client acknowledges every data segment at once and retransmits its
+ * unacknowledged data after 200ms. It checks the IP and TCP checksum of
+ * every frame from the server, parses the responses (Content-Length or
+ * chunked) and checks that every request is answered and no connection is
+ * reset.
+ *
+ * The benchmark polls a page back to back, once with a new connection per
+ * poll (Connection: close) and once over kept alive connections, and prints
+ * the frames per poll and the polls per second. The pipelining test sends
+ * a second request while the first response is still being sent.
+ *
+ * The build switches the ENC28J60 specific paths off: UIP_ARCH_CHKSUM 0
+ * (software checksum, so the checksums can be checked), PAGE_CACHE_SUPPORT
+ * 0, and the retransmit cache calls are stubbed out, so UIP_TCP_WINDOW
+ * falls back to one segment in flight.
+ *
+ * Build and run with tools/httpd_test.sh.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "uipopt.h"
+#include "uip.h"
+#include "httpd.h"
+#include "Enc28j60.h"
+
+#if UIP_STATISTICS != 1 || HTTP_KEEPALIVE_SUPPORT != 1
+#error "httpd_test needs UIP_STATISTICS == 1 and HTTP_KEEPALIVE_SUPPORT == 1"
+#endif
+#if UIP_ARCH_CHKSUM != 0 || PAGE_CACHE_SUPPORT != 0
+#error "httpd_test needs UIP_ARCH_CHKSUM == 0 and PAGE_CACHE_SUPPORT == 0"
+#endif
+
+
+/*---------------------------------------------------------------------------*/
+/* Everything httpd.c and uip.c need from the rest of the firmware */
+uint8_t IO_16to9;
+uint8_t IO_8to1 = 0x5a;
+uint8_t invert_output;
+uint8_t Pending_hostaddr4, Pending_hostaddr3, Pending_hostaddr2, Pending_hostaddr1;
+uint8_t Pending_draddr4, Pending_draddr3, Pending_draddr2, Pending_draddr1;
+uint8_t Pending_netmask4, Pending_netmask3, Pending_netmask2, Pending_netmask1;
+uint16_t Pending_port;
+uint8_t Pending_uip_ethaddr1, Pending_uip_ethaddr2, Pending_uip_ethaddr3;
+uint8_t Pending_uip_ethaddr4, Pending_uip_ethaddr5, Pending_uip_ethaddr6;
+uint8_t enc28j60_config;
+uint8_t Pending_enc28j60_config;
+uint8_t ex_stored_hostaddr4, ex_stored_hostaddr3, ex_stored_hostaddr2, ex_stored_hostaddr1;
+uint8_t ex_stored_draddr4, ex_stored_draddr3, ex_stored_draddr2, ex_stored_draddr1;
+uint8_t ex_stored_netmask4, ex_stored_netmask3, ex_stored_netmask2, ex_stored_netmask1;
+uint16_t ex_stored_port = 80;
+uint8_t uip_ethaddr1, uip_ethaddr2, uip_ethaddr3;
+uint8_t uip_ethaddr4, uip_ethaddr5, uip_ethaddr6;
+uint8_t ex_stored_devicename[20] = "NewDevice000";
+uint8_t submit_changes;
+uint16_t Port_Httpd = 80;
+
+static uint32_t Now; // Simulated time in microseconds
+
+uint16_t clock_ms(void)
+{
+  return (uint16_t)(Now / 1000);
+}
+
+void debugflash(void)
+{
+}
+
+uint8_t Enc28j60Rexmit(struct uip_conn* conn)
+{
+  (void)conn;
+  return 0;
+}
+
+uint8_t Enc28j60CanPin(void)
+{
+  return 0;
+}
+
+void Enc28j60PinNext(void)
+{
+}
+
+uint8_t Enc28j60Pinned(struct uip_conn* conn)
+{
+  (void)conn;
+  return 0;
+}
+
+uint8_t Enc28j60Acked(struct uip_conn* conn, uint32_t Ackno, uint16_t* pBytes)
+{
+  (void)conn;
+  (void)Ackno;
+  *pBytes = 0;
+  return 0;
+}
+
+void Enc28j60Unpin(struct uip_conn* conn)
+{
+  (void)conn;
+}
+
+
+/*---------------------------------------------------------------------------*/
+static unsigned Checks;
+static unsigned Failures;
+
+#define CHECK(cond) do { \
+  Checks++; \
+  if (!(cond)) { \
+    Failures++; \
+    printf("%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+  } } while (0)
+
+#define F_FIN 0x01
+#define F_SYN 0x02
+#define F_RST 0x04
+#define F_ACK 0x10
+
+/* Frame offsets. uip_buf holds the frame with UIP_LLH_LEN bytes of
+   Ethernet header in front of the IP header. */
+#define O_IP   UIP_LLH_LEN
+#define O_TCP  (O_IP + 20)
+
+static const uint8_t ServerIp[4] = { 192, 168, 1, 4 };
+static const uint8_t ClientIp[4] = { 192, 168, 1, 100 };
+
+#define LINK_DELAY   50     // us from the end of a frame to its delivery
+#define SERVER_STEP  100    // us between passes of the server loop
+#define CLIENT_RTO   200000 // us before the client retransmits
+
+
+/*---------------------------------------------------------------------------*/
+/* The link. Frames in flight are kept in the order they arrive. */
+#define M_LINK 64
+struct frame {
+  uint32_t Due;
+  uint8_t ToServer;
+  uint16_t nLen;
+  uint8_t Data[UIP_BUFSIZE];
+};
+static struct frame Link[M_LINK];
+static unsigned nLink;
+static uint32_t LinkFree[2];
+static unsigned Frames;
+
+
+static void LinkSend(uint8_t nToServer, const uint8_t* pFrame, uint16_t nLen)
+{
+  // Puts a frame on the wire. 10 Mbit/s is 0.8us per byte; preamble, FCS
+  // and interframe gap add 24 bytes and short frames are padded to 60.
+  uint32_t nStart;
+  uint16_t nWire;
+
+  CHECK(nLink < M_LINK);
+  if (nLink == M_LINK) return;
+  nWire = nLen < 60 ? 60 : nLen;
+  nStart = LinkFree[nToServer] > Now ? LinkFree[nToServer] : Now;
+  LinkFree[nToServer] = nStart + (uint32_t)(nWire + 24) * 8 / 10;
+  Link[nLink].Due = LinkFree[nToServer] + LINK_DELAY;
+  Link[nLink].ToServer = nToServer;
+  Link[nLink].nLen = nLen;
+  memcpy(Link[nLink].Data, pFrame, nLen);
+  nLink++;
+  Frames++;
+}
+
+
+static int LinkReceive(uint8_t nToServer, uint8_t* pFrame)
+{
+  // Takes the first frame due for one side off the wire. Returns its
+  // length, -1 if there is none.
+  unsigned i;
+  int nLen;
+
+  for (i = 0; i < nLink; i++) {
+    if (Link[i].ToServer == nToServer && Link[i].Due <= Now) {
+      nLen = Link[i].nLen;
+      memcpy(pFrame, Link[i].Data, Link[i].nLen);
+      memmove(&Link[i], &Link[i + 1], (nLink - i - 1) * sizeof(Link[0]));
+      nLink--;
+      return nLen;
+    }
+  }
+  return -1;
+}
+
+
+static uint16_t Get16(const uint8_t* p)
+{
+  return (uint16_t)((p[0] << 8) | p[1]);
+}
+
+static uint32_t Get32(const uint8_t* p)
+{
+  return ((uint32_t)Get16(p) << 16) | Get16(p + 2);
+}
+
+static void Put16(uint8_t* p, uint16_t n)
+{
+  p[0] = (uint8_t)(n >> 8);
+  p[1] = (uint8_t)n;
+}
+
+static void Put32(uint8_t* p, uint32_t n)
+{
+  Put16(p, (uint16_t)(n >> 16));
+  Put16(p + 2, (uint16_t)n);
+}
+
+static uint32_t Sum(uint32_t s, const uint8_t* p, unsigned n)
+{
+  unsigned i;
+
+  for (i = 0; i < n; i++) s += (i & 1) ? p[i] : (uint32_t)p[i] << 8;
+  return s;
+}
+
+static uint16_t Fold(uint32_t s)
+{
+  while (s >> 16) s = (s & 0xffff) + (s >> 16);
+  return (uint16_t)~s;
+}
+
+static uint16_t TcpChksum(const uint8_t* f, uint16_t nTcp)
+{
+  // One's complement of the TCP segment sum including the pseudo header.
+  // 0 for a segment with a correct checksum.
+  uint8_t Pseudo[4];
+
+  Pseudo[0] = 0;
+  Pseudo[1] = UIP_PROTO_TCP;
+  Put16(&Pseudo[2], nTcp);
+  return Fold(Sum(Sum(Sum(0, &f[O_IP + 12], 8), Pseudo, 4), &f[O_TCP], nTcp));
+}
+
+
+/*---------------------------------------------------------------------------*/
+/* The server: the main loop of main.c without ARP and the ENC28J60 */
+static void ServerOutput(void)
+{
+  if (uip_len > 0) LinkSend(0, uip_buf, uip_len + UIP_LLH_LEN);
+  uip_len = 0;
+}
+
+
+static void ServerStep(void)
+{
+  static uint32_t NextPeriodic;
+  int nLen;
+  uint8_t i;
+
+  while ((nLen = LinkReceive(1, uip_buf)) >= 0) {
+    uip_len = (uint16_t)(nLen - UIP_LLH_LEN);
+    uip_input();
+    ServerOutput();
+  }
+  for (i = 0; i < UIP_CONNS; i++) {
+    uip_rexmit_timer(i);
+    ServerOutput();
+  }
+  if (Now >= NextPeriodic) {
+    NextPeriodic = Now + 512000;
+    for (i = 0; i < UIP_CONNS; i++) {
+      uip_periodic(i);
+      ServerOutput();
+    }
+  }
+}
+
+
+static void ServerInit(void)
+{
+  uip_init();
+  uip_init_stats();
+  uip_ipaddr_copy(uip_hostaddr, (uint16_t*)ServerIp);
+  HttpDInit();
+}
+
+
+/*---------------------------------------------------------------------------*/
+/* The client */
+#define C_CLOSED  0
+#define C_SYNSENT 1
+#define C_OPEN    2
+#define C_FINSENT 3
+
+#define R_HEADER  0 // Reading the response header
+#define R_LENGTH  1 // Reading a body of known length
+#define R_SIZE    2 // Reading a chunk size line
+#define R_DATA    3 // Reading chunk data
+#define R_DATAEND 4 // Reading the CRLF behind chunk data
+#define R_LAST    5 // Reading the CRLF behind the closing chunk
+#define R_CLOSE   6 // Reading a body that ends when the connection closes
+
+static struct {
+  uint8_t State;
+  uint16_t Port;
+  uint32_t SndUna;
+  uint32_t SndNxt;
+  uint32_t RcvNxt;
+  uint32_t RtxDue;
+  uint8_t Tx[256];     // Data from SndUna on
+  uint16_t nTx;
+
+  uint8_t Resp;        // R_ state of the response parser
+  char Header[256];
+  uint16_t nHeader;
+  uint32_t nLeft;      // Body or chunk bytes still to come
+  uint32_t nBody;      // Body bytes of the current response
+  uint8_t Close;       // The response says Connection:close
+  uint8_t nPending;    // Requests sent and not answered yet
+} Client;
+
+static uint16_t NextPort = 1024;
+static unsigned Responses;
+static unsigned Unanswered;
+static unsigned Resets;
+static unsigned Connections;
+static uint32_t LastBody;
+
+
+static void ClientSend(uint8_t nFlags, uint32_t nSeq, const uint8_t* pData, uint16_t nData)
+{
+  // Sends a segment from the client to the server
+  uint8_t f[UIP_BUFSIZE];
+  uint8_t nTcp;
+
+  nTcp = (nFlags & F_SYN) ? 24 : 20;
+  memset(f, 0, O_TCP + nTcp);
+  f[O_IP] = 0x45;
+  Put16(&f[O_IP + 2], (uint16_t)(20 + nTcp + nData));
+  f[O_IP + 8] = 64;
+  f[O_IP + 9] = UIP_PROTO_TCP;
+  memcpy(&f[O_IP + 12], ClientIp, 4);
+  memcpy(&f[O_IP + 16], ServerIp, 4);
+  Put16(&f[O_IP + 10], Fold(Sum(0, &f[O_IP], 20)));
+
+  Put16(&f[O_TCP], Client.Port);
+  Put16(&f[O_TCP + 2], Port_Httpd);
+  Put32(&f[O_TCP + 4], nSeq);
+  Put32(&f[O_TCP + 8], (nFlags & F_ACK) ? Client.RcvNxt : 0);
+  f[O_TCP + 12] = (uint8_t)(nTcp << 2);
+  f[O_TCP + 13] = nFlags;
+  Put16(&f[O_TCP + 14], 8192);
+  if (nFlags & F_SYN) {
+    // MSS option of 1460
+    f[O_TCP + 20] = 2;
+    f[O_TCP + 21] = 4;
+    Put16(&f[O_TCP + 22], 1460);
+  }
+  memcpy(&f[O_TCP + nTcp], pData, nData);
+  Put16(&f[O_TCP + 16], TcpChksum(f, (uint16_t)(nTcp + nData)));
+
+  LinkSend(1, f, (uint16_t)(O_TCP + nTcp + nData));
+}
+
+
+static void ClientConnect(void)
+{
+  Client.State = C_SYNSENT;
+  Client.Port = NextPort++;
+  Client.SndUna = Client.SndNxt = (uint32_t)Client.Port << 16;
+  Client.nTx = 0;
+  Client.Resp = R_HEADER;
+  Client.nHeader = 0;
+  Client.Close = 0;
+  Client.nPending = 0;
+  ClientSend(F_SYN, Client.SndNxt, 0, 0);
+  Client.SndNxt++;
+  Client.RtxDue = Now + CLIENT_RTO;
+  Connections++;
+}
+
+
+static void ClientRequest(const char* pUrl, uint8_t nClose)
+{
+  // Sends a GET request on the open connection
+  char Request[128];
+  uint16_t n;
+
+  n = (uint16_t)sprintf(Request, "GET %s HTTP/1.1\r\nHost: 192.168.1.4\r\n%s\r\n",
+    pUrl, nClose ? "Connection: close\r\n" : "");
+  CHECK(Client.State == C_OPEN && Client.nTx + n <= sizeof(Client.Tx));
+  if (Client.State != C_OPEN || Client.nTx + n > sizeof(Client.Tx)) return;
+  if (Client.nTx == 0) Client.RtxDue = Now + CLIENT_RTO;
+  memcpy(&Client.Tx[Client.nTx], Request, n);
+  Client.nTx += n;
+  ClientSend(F_ACK, Client.SndNxt, (uint8_t*)Request, n);
+  Client.SndNxt += n;
+  Client.nPending++;
+}
+
+
+static void ClientResponseDone(void)
+{
+  Responses++;
+  LastBody = Client.nBody;
+  CHECK(Client.nPending != 0);
+  if (Client.nPending) Client.nPending--;
+  Client.Resp = R_HEADER;
+  Client.nHeader = 0;
+}
+
+
+static void ClientParse(const uint8_t* p, uint16_t n)
+{
+  // Runs the response parser over n bytes of the response stream
+  char* pField;
+
+  while (n != 0) {
+    switch (Client.Resp) {
+    case R_HEADER:
+      CHECK(Client.nHeader < sizeof(Client.Header) - 1);
+      if (Client.nHeader < sizeof(Client.Header) - 1) Client.Header[Client.nHeader++] = (char)*p;
+      Client.Header[Client.nHeader] = 0;
+      if (Client.nHeader >= 4 && strcmp(&Client.Header[Client.nHeader - 4], "\r\n\r\n") == 0) {
+        CHECK(strncmp(Client.Header, "HTTP/1.1 200 OK\r\n", 17) == 0);
+        Client.Close = (uint8_t)(strstr(Client.Header, "Connection:close") != 0);
+        Client.nBody = 0;
+        pField = strstr(Client.Header, "Content-Length:");
+        if (pField) {
+          Client.nLeft = (uint32_t)atol(pField + 15);
+          Client.Resp = R_LENGTH;
+          if (Client.nLeft == 0) ClientResponseDone();
+        }
+        else if (strstr(Client.Header, "Transfer-Encoding:chunked")) {
+          Client.Resp = R_SIZE;
+          Client.nLeft = 0;
+        }
+        else {
+          CHECK(Client.Close);
+          Client.Resp = R_CLOSE;
+        }
+      }
+      break;
+
+    case R_LENGTH:
+      Client.nBody++;
+      if (--Client.nLeft == 0) ClientResponseDone();
+      break;
+
+    case R_SIZE:
+      if (*p == '\n') {
+        Client.Resp = Client.nLeft ? R_DATA : R_LAST;
+      }
+      else if (*p != '\r') {
+        CHECK((*p >= '0' && *p <= '9') || (*p >= 'a' && *p <= 'f') || (*p >= 'A' && *p <= 'F'));
+        Client.nLeft = Client.nLeft * 16 + (uint32_t)(*p <= '9' ? *p - '0' : (*p | 0x20) - 'a' + 10);
+      }
+      break;
+
+    case R_DATA:
+      Client.nBody++;
+      if (--Client.nLeft == 0) Client.Resp = R_DATAEND;
+      break;
+
+    case R_DATAEND:
+      CHECK(*p == '\r' || *p == '\n');
+      if (*p == '\n') Client.Resp = R_SIZE;
+      break;
+
+    case R_LAST:
+      CHECK(*p == '\r' || *p == '\n');
+      if (*p == '\n') ClientResponseDone();
+      break;
+
+    case R_CLOSE:
+      Client.nBody++;
+      break;
+    }
+    p++;
+    n--;
+  }
+}
+
+
+static void ClientStep(void)
+{
+  uint8_t f[UIP_BUFSIZE];
+  int nLen;
+  uint8_t nFlags;
+  uint16_t nTcp;
+  uint16_t nData;
+  uint32_t nSeq;
+  uint32_t nAck;
+
+  while ((nLen = LinkReceive(0, f)) >= 0) {
+    CHECK(Fold(Sum(0, &f[O_IP], 20)) == 0);
+    nTcp = (uint16_t)(Get16(&f[O_IP + 2]) - 20);
+    CHECK(TcpChksum(f, nTcp) == 0);
+    CHECK(O_IP + 20 + nTcp == nLen);
+
+    // Late segments of an earlier connection are dropped
+    if (Get16(&f[O_TCP + 2]) != Client.Port || Client.State == C_CLOSED) continue;
+
+    nFlags = f[O_TCP + 13];
+    nSeq = Get32(&f[O_TCP + 4]);
+    nAck = Get32(&f[O_TCP + 8]);
+    nData = (uint16_t)(nTcp - (f[O_TCP + 12] >> 4) * 4);
+
+    if (nFlags & F_RST) {
+      Resets++;
+      Unanswered += Client.nPending;
+      Client.State = C_CLOSED;
+      continue;
+    }
+
+    if (nFlags & F_ACK) {
+      if ((int32_t)(nAck - Client.SndUna) > 0 && (int32_t)(nAck - Client.SndNxt) <= 0) {
+        if (Client.State != C_SYNSENT && Client.State != C_FINSENT) {
+          memmove(Client.Tx, &Client.Tx[nAck - Client.SndUna], Client.nTx - (nAck - Client.SndUna));
+          Client.nTx = (uint16_t)(Client.nTx - (nAck - Client.SndUna));
+        }
+        Client.SndUna = nAck;
+        Client.RtxDue = Now + CLIENT_RTO;
+      }
+    }
+
+    if (Client.State == C_SYNSENT) {
+      if ((nFlags & (F_SYN | F_ACK)) == (F_SYN | F_ACK) && nAck == Client.SndNxt) {
+        Client.RcvNxt = nSeq + 1;
+        Client.State = C_OPEN;
+        ClientSend(F_ACK, Client.SndNxt, 0, 0);
+      }
+      continue;
+    }
+
+    if (Client.State == C_FINSENT) {
+      if (nAck == Client.SndNxt) Client.State = C_CLOSED;
+      continue;
+    }
+
+    if (nSeq == Client.RcvNxt && nData != 0) {
+      Client.RcvNxt += nData;
+      ClientParse(&f[O_TCP + nTcp - nData], nData);
+    }
+    if ((nFlags & F_FIN) && nSeq + nData == Client.RcvNxt) {
+      // The server closed. Requests it has not answered are lost.
+      Client.RcvNxt++;
+      if (Client.Resp == R_CLOSE) ClientResponseDone();
+      Unanswered += Client.nPending;
+      Client.nPending = 0;
+      ClientSend(F_FIN | F_ACK, Client.SndNxt, 0, 0);
+      Client.SndNxt++;
+      Client.State = C_FINSENT;
+      continue;
+    }
+    if (nData != 0) ClientSend(F_ACK, Client.SndNxt, 0, 0);
+  }
+
+  // Retransmit what the server has not acknowledged
+  if (Client.State == C_OPEN && Client.nTx != 0 && Now >= Client.RtxDue) {
+    ClientSend(F_ACK, Client.SndUna, Client.Tx, Client.nTx);
+    Client.RtxDue = Now + CLIENT_RTO;
+  }
+}
+
+
+static void Step(void)
+{
+  ClientStep();
+  ServerStep();
+  Now += SERVER_STEP;
+}
+
+
+static void Drain(uint32_t nUs)
+{
+  // Lets the network settle for nUs
+  uint32_t nEnd;
+
+  nEnd = Now + nUs;
+  while (Now < nEnd) Step();
+}
+
+
+/*---------------------------------------------------------------------------*/
+static void ResetAll(void)
+{
+  ServerInit();
+  memset(&Client, 0, sizeof(Client));
+  nLink = 0;
+  LinkFree[0] = LinkFree[1] = Now;
+  Frames = Responses = Unanswered = Resets = Connections = 0;
+}
+
+
+static void Bench(const char* pUrl, uint8_t nClose, unsigned nPolls)
+{
+  // Polls pUrl back to back: the next request goes out as soon as the
+  // previous response is complete, on the same connection if it is still
+  // open. Prints frames per poll and polls per second.
+  uint32_t nStart;
+  uint32_t nTime;
+  uint32_t nBody;
+  unsigned nSent;
+
+  ResetAll();
+  nStart = Now;
+  nSent = 0;
+  nBody = 0;
+  while (Responses < nPolls && Now - nStart < 60000000) {
+    if (Client.State == C_OPEN && Client.nPending == 0 && nSent == Responses && !Client.Close) {
+      ClientRequest(pUrl, nClose);
+      nSent++;
+    }
+    else if (Client.State == C_CLOSED || (Client.Close && Client.nPending == 0 && Client.State != C_SYNSENT)) {
+      // A new connection for the next request. A connection the server
+      // closes is forgotten once its FIN is acknowledged.
+      if (Client.State == C_CLOSED || Client.State == C_FINSENT) ClientConnect();
+    }
+    if (Responses != 0 && nBody == 0) nBody = LastBody;
+    Step();
+  }
+  nTime = Now - nStart;
+  Drain(1000000);
+
+  printf("%-4s %-10s %4u polls: %5.2f frames per poll, %6.1f polls per second, %u connections, %u body bytes\n",
+    pUrl, nClose ? "close" : "keep-alive", Responses, (double)Frames / Responses,
+    Responses * 1e6 / nTime, Connections, (unsigned)nBody);
+  CHECK(Responses == nPolls);
+  CHECK(Unanswered == 0);
+  CHECK(Resets == 0);
+  CHECK(LastBody == nBody && nBody != 0);
+  CHECK(uip_stat.http.requests == nPolls);
+  CHECK(uip_stat.http.deferred == 0);
+  CHECK(uip_stat.tcp.syndrop == 0);
+  if (nClose) CHECK(Connections == nPolls);
+  else CHECK(Connections == (nPolls + HTTP_KEEPALIVE_MAX - 1) / HTTP_KEEPALIVE_MAX);
+}
+
+
+static void TestPipelined(void)
+{
+  // Sends a request for /99 right behind one for the IO page. The second
+  // one arrives while the page is being sent and must be answered too, on
+  // the same connection.
+  unsigned i;
+
+  ResetAll();
+  ClientConnect();
+  while (Client.State != C_OPEN) Step();
+  for (i = 0; i < 10 && Client.State == C_OPEN; i++) {
+    ClientRequest("/60", 0);
+    ClientRequest("/99", 0);
+    while (Client.nPending != 0 && Client.State == C_OPEN) Step();
+  }
+  Drain(1000000);
+
+  printf("pipelined: %u requests, %u answered, %u deferred, %u connections\n",
+    20, Responses, (unsigned)uip_stat.http.deferred, Connections);
+  CHECK(Responses == 20);
+  CHECK(Unanswered == 0);
+  CHECK(Resets == 0);
+  CHECK(Connections == 1);
+  CHECK(Client.State == C_OPEN);
+  CHECK(uip_stat.http.requests == 20);
+  CHECK(uip_stat.http.deferred >= 10);
+}
+
+
+int main(void)
+{
+  Bench("/99", 1, 250);
+  Bench("/99", 0, 250);
+  Bench("/60", 1, 50);
+  Bench("/60", 0, 50);
+  TestPipelined();
+
+  printf("%u checks, %u failures\n", Checks, Failures);
+  return Failures ? 1 : 0;
+}
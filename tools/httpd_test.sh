@@ -0,0 +1,39 @@
+#!/bin/sh
+# Builds and runs the web server test and benchmark on the host.
+#
+# httpd.c, uip.c and uip_TcpAppHub.c are copied with the Cosmic keywords
+# (@far etc.) removed. In the copy of uipopt.h UIP_BYTE_ORDER is set to
+# little endian, UIP_ASM_CHKSUM and UIP_ARCH_CHKSUM to 0 (software
+# checksum) and PAGE_CACHE_SUPPORT to 0. The other uipopt.h settings are
+# used as they are.
+#
+# Usage: sh tools/httpd_test.sh
+
+set -e
+
+top=$(cd "$(dirname "$0")/.." && pwd)
+out=${TMPDIR:-/tmp}/httpd_test
+rm -rf "$out"
+mkdir -p "$out"
+
+for f in "$top"/NetworkModule/*.c "$top"/NetworkModule/*.h; do
+  sed -e 's/@far//g; s/@interrupt//g; s/@eeprom//g; s/@tiny//g; s/@near//g' \
+    "$f" > "$out/$(basename "$f")"
+done
+cp "$top"/tools/host/*.h "$out"
+# The sources include some headers in lower case
+for f in "$out"/*.h; do
+  l=$(basename "$f" | tr A-Z a-z)
+  [ -e "$out/$l" ] || ln -s "$(basename "$f")" "$out/$l"
+done
+sed -i -e 's/^#define UIP_BYTE_ORDER .*/#define UIP_BYTE_ORDER  UIP_LITTLE_ENDIAN/' \
+  -e 's/^#define UIP_ASM_CHKSUM .*/#define UIP_ASM_CHKSUM  0/' \
+  -e 's/^#define UIP_ARCH_CHKSUM .*/#define UIP_ARCH_CHKSUM  0/' \
+  -e 's/^#define PAGE_CACHE_SUPPORT .*/#define PAGE_CACHE_SUPPORT  0/' "$out/uipopt.h"
+
+${CC:-cc} -std=c99 -Wall -Wno-unused-function -Wno-pointer-sign \
+  -Wno-missing-braces -Wno-unused-label -I"$out" \
+  -o "$out/httpd_test" \
+  "$out/httpd.c" "$out/uip.c" "$out/uip_TcpAppHub.c" "$top/tools/httpd_test.c"
+
+"$out/httpd_test"
@@ -0,0 +1,387 @@
+/*
+ * Host load test for the uIP connection table (NetworkModule/uip.c).
+ *
+ * N pollers each open a new connection once per second, send a GET, read
+ * the response and close, like SCADA pollers fetching /99. The server side
+ * answers every request with a short page and closes first, so every
+ * request leaves a connection in TIME_WAIT. All pollers start in the same
+ * millisecond, so up to N connections are open at once. The network is
+ * lossless and delivers every segment immediately; time advances in 10ms
+ * steps, the retransmission timer runs on every step and the periodic
+ * timer every 512ms as in main.c.
+ *
+ * For N = 1 to UIP_CONNS the test runs 300 seconds of polling and checks
+ * that every request is answered, no SYN is dropped (uip_stat.tcp.syndrop)
+ * and no RST is seen. With the full UIP_TIME_WAIT_TIMEOUT it also checks
+ * that the table really was full of TIME_WAIT connections when SYNs came
+ * in, so the reuse of the oldest one is what kept the drops at zero.
+ *
+ * uip.c is built as it is with the uipopt.h settings. The ENC28J60
+ * retransmit cache is stubbed out, so retransmissions are rebuilt by the
+ * application and UIP_TCP_WINDOW falls back to one segment in flight.
+ *
+ * Build and run with tools/tcp_load_test.sh.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "uipopt.h"
+#include "uip.h"
+#include "Enc28j60.h"
+
+#if UIP_STATISTICS != 1
+#error "tcp_load_test needs UIP_STATISTICS == 1"
+#endif
+
+
+/*---------------------------------------------------------------------------*/
+/* Everything uip.c needs from the rest of the firmware */
+static uint16_t Now;
+
+uint16_t clock_ms(void)
+{
+  return Now;
+}
+
+uint8_t Enc28j60Rexmit(struct uip_conn* conn)
+{
+  (void)conn;
+  return 0;
+}
+
+uint8_t Enc28j60CanPin(void)
+{
+  return 0;
+}
+
+void Enc28j60PinNext(void)
+{
+}
+
+uint8_t Enc28j60Pinned(struct uip_conn* conn)
+{
+  (void)conn;
+  return 0;
+}
+
+uint8_t Enc28j60Acked(struct uip_conn* conn, uint32_t Ackno, uint16_t* pBytes)
+{
+  (void)conn;
+  (void)Ackno;
+  *pBytes = 0;
+  return 0;
+}
+
+void Enc28j60Unpin(struct uip_conn* conn)
+{
+  (void)conn;
+}
+
+/* The application: answer a request with a short page, close once it is
+   acknowledged */
+static const char Page[] =
+  "HTTP/1.1 200 OK\r\nContent-Type: text/html\r\nConnection: close\r\n\r\n"
+  "<html><body>1010101010101010</body></html>";
+
+void uip_TcpAppHubCall(void)
+{
+  if (uip_newdata() || uip_rexmit()) uip_send(Page, sizeof(Page) - 1);
+  else if (uip_acked()) uip_close();
+}
+
+
+/*---------------------------------------------------------------------------*/
+static unsigned Checks;
+static unsigned Failures;
+
+#define CHECK(cond) do { \
+  Checks++; \
+  if (!(cond)) { \
+    Failures++; \
+    printf("%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+  } } while (0)
+
+#define F_FIN 0x01
+#define F_SYN 0x02
+#define F_RST 0x04
+#define F_ACK 0x10
+
+/* Frame offsets. uip_buf holds the frame with UIP_LLH_LEN bytes of
+   Ethernet header in front of the IP header. */
+#define O_IP   UIP_LLH_LEN
+#define O_TCP  (O_IP + 20)
+#define O_DATA (O_TCP + 20)
+
+static const uint8_t ServerIp[4] = { 192, 168, 1, 4 };
+#define SERVER_PORT 80
+
+static const char Request[] = "GET /99 HTTP/1.1\r\nHost: 192.168.1.4\r\n\r\n";
+
+/* Poller states */
+#define P_IDLE    0
+#define P_SYNSENT 1
+#define P_WAIT    2 // Request sent, waiting for the page and the FIN
+#define P_LASTACK 3 // FIN sent, waiting for its ACK
+
+struct poller {
+  uint8_t State;
+  uint16_t Port;
+  uint32_t SndNxt;
+  uint32_t RcvNxt;
+  uint16_t nPage;
+};
+
+#define M_POLLERS UIP_CONNS
+static struct poller Pollers[M_POLLERS];
+static uint8_t nPollers;
+
+static unsigned Started;
+static unsigned Completed;
+static unsigned Resets;
+static unsigned FullTable;
+
+/* Segments on their way to the server */
+#define M_QUEUE 64
+static uint8_t Queue[M_QUEUE][O_DATA + sizeof(Request)];
+static uint16_t QueueLen[M_QUEUE];
+static unsigned QueueHead;
+static unsigned QueueTail;
+
+
+static uint16_t Get16(const uint8_t* p)
+{
+  return (uint16_t)((p[0] << 8) | p[1]);
+}
+
+static uint32_t Get32(const uint8_t* p)
+{
+  return ((uint32_t)Get16(p) << 16) | Get16(p + 2);
+}
+
+static void Put16(uint8_t* p, uint16_t n)
+{
+  p[0] = (uint8_t)(n >> 8);
+  p[1] = (uint8_t)n;
+}
+
+static void Put32(uint8_t* p, uint32_t n)
+{
+  Put16(p, (uint16_t)(n >> 16));
+  Put16(p + 2, (uint16_t)n);
+}
+
+static uint32_t Sum(uint32_t s, const uint8_t* p, unsigned n)
+{
+  unsigned i;
+
+  for (i = 0; i < n; i++) s += (i & 1) ? p[i] : (uint32_t)p[i] << 8;
+  return s;
+}
+
+static uint16_t Fold(uint32_t s)
+{
+  while (s >> 16) s = (s & 0xffff) + (s >> 16);
+  return (uint16_t)~s;
+}
+
+
+static void ClientSend(struct poller* p, uint8_t nFlags, const char* pData, uint16_t nData)
+{
+  // Queues a segment from poller p to the server. A SYN carries an MSS
+  // option of 1460 like any real client's.
+  uint8_t* f;
+  uint8_t Pseudo[4];
+  uint8_t nTcp;
+
+  CHECK(QueueTail - QueueHead < M_QUEUE);
+  f = Queue[QueueTail % M_QUEUE];
+  memset(f, 0, O_DATA + 4);
+  nTcp = (nFlags & F_SYN) ? 24 : 20;
+
+  f[O_IP] = 0x45;
+  Put16(&f[O_IP + 2], (uint16_t)(20 + nTcp + nData));
+  f[O_IP + 8] = 64;
+  f[O_IP + 9] = UIP_PROTO_TCP;
+  f[O_IP + 12] = 192;
+  f[O_IP + 13] = 168;
+  f[O_IP + 14] = 1;
+  f[O_IP + 15] = (uint8_t)(100 + (p - Pollers));
+  memcpy(&f[O_IP + 16], ServerIp, 4);
+  Put16(&f[O_IP + 10], Fold(Sum(0, &f[O_IP], 20)));
+
+  Put16(&f[O_TCP], p->Port);
+  Put16(&f[O_TCP + 2], SERVER_PORT);
+  Put32(&f[O_TCP + 4], p->SndNxt);
+  Put32(&f[O_TCP + 8], (nFlags & F_ACK) ? p->RcvNxt : 0);
+  f[O_TCP + 12] = (uint8_t)(nTcp << 2);
+  f[O_TCP + 13] = nFlags;
+  Put16(&f[O_TCP + 14], 4096);
+  if (nFlags & F_SYN) {
+    f[O_DATA] = 2;
+    f[O_DATA + 1] = 4;
+    Put16(&f[O_DATA + 2], 1460);
+  }
+  memcpy(&f[O_TCP + nTcp], pData, nData);
+
+  Pseudo[0] = 0;
+  Pseudo[1] = UIP_PROTO_TCP;
+  Put16(&Pseudo[2], (uint16_t)(nTcp + nData));
+  Put16(&f[O_TCP + 16], Fold(Sum(Sum(Sum(0, &f[O_IP + 12], 8), Pseudo, 4), &f[O_TCP], nTcp + nData)));
+
+  QueueLen[QueueTail % M_QUEUE] = (uint16_t)(O_TCP + nTcp + nData);
+  QueueTail++;
+
+  p->SndNxt += nData;
+  if (nFlags & (F_SYN | F_FIN)) p->SndNxt++;
+}
+
+
+static void ClientReceive(void)
+{
+  // Hands the segment uip left in uip_buf to the poller it is for, which
+  // answers it the way a client TCP would
+  struct poller* p;
+  uint8_t nFlags;
+  uint16_t nData;
+  uint32_t nSeq;
+  uint8_t i;
+
+  if (uip_len == 0) return;
+
+  p = 0;
+  for (i = 0; i < nPollers; i++) {
+    if (uip_buf[O_IP + 19] == 100 + i && Get16(&uip_buf[O_TCP + 2]) == Pollers[i].Port) p = &Pollers[i];
+  }
+  uip_len = 0;
+  // Late segments of a finished connection are dropped by the client
+  if (p == 0 || p->State == P_IDLE) return;
+
+  nFlags = uip_buf[O_TCP + 13];
+  nSeq = Get32(&uip_buf[O_TCP + 4]);
+  nData = (uint16_t)(Get16(&uip_buf[O_IP + 2]) - 20 - (uip_buf[O_TCP + 12] >> 4) * 4);
+
+  if (nFlags & F_RST) {
+    Resets++;
+    p->State = P_IDLE;
+    return;
+  }
+
+  if (p->State == P_SYNSENT) {
+    if ((nFlags & (F_SYN | F_ACK)) != (F_SYN | F_ACK)) return;
+    CHECK(Get32(&uip_buf[O_TCP + 8]) == p->SndNxt);
+    p->RcvNxt = nSeq + 1;
+    p->nPage = 0;
+    ClientSend(p, F_ACK, Request, sizeof(Request) - 1);
+    p->State = P_WAIT;
+    return;
+  }
+
+  // In order data and FIN only; anything else is acknowledged again
+  if (nSeq == p->RcvNxt && nData != 0) {
+    p->RcvNxt += nData;
+    p->nPage += nData;
+  }
+  if (p->State == P_WAIT && (nFlags & F_FIN) && nSeq + nData == p->RcvNxt) {
+    p->RcvNxt++;
+    CHECK(p->nPage == sizeof(Page) - 1);
+    ClientSend(p, F_FIN | F_ACK, 0, 0);
+    p->State = P_LASTACK;
+    return;
+  }
+  if (p->State == P_LASTACK && (nFlags & F_ACK) && Get32(&uip_buf[O_TCP + 8]) == p->SndNxt) {
+    Completed++;
+    p->State = P_IDLE;
+    return;
+  }
+  if (nData != 0 || (nFlags & F_FIN)) ClientSend(p, F_ACK, 0, 0);
+}
+
+
+static void Deliver(void)
+{
+  // Feeds the queued segments to uip
+  while (QueueHead != QueueTail) {
+    memcpy(uip_buf, Queue[QueueHead % M_QUEUE], QueueLen[QueueHead % M_QUEUE]);
+    uip_len = QueueLen[QueueHead % M_QUEUE];
+    QueueHead++;
+    uip_input();
+    ClientReceive();
+  }
+}
+
+
+static void Run(uint8_t n, uint16_t nSeconds)
+{
+  // Polls with n pollers for nSeconds and checks the outcome
+  uint32_t t;
+  uint16_t nPort;
+  uint8_t i;
+
+  uip_init();
+  uip_init_stats();
+  uip_sethostaddr((uint16_t*)ServerIp);
+  uip_listen(HTONS(SERVER_PORT));
+
+  memset(Pollers, 0, sizeof(Pollers));
+  nPollers = n;
+  Started = Completed = Resets = FullTable = 0;
+  QueueHead = QueueTail = 0;
+  nPort = 1024;
+
+  // Two more seconds without new requests let the last ones finish
+  for (t = 0; t < (uint32_t)(nSeconds + 2) * 1000; t += 10) {
+    Now = (uint16_t)t;
+
+    if (t % 1000 == 0 && t < (uint32_t)nSeconds * 1000) {
+      for (i = 0; i < UIP_CONNS; i++) {
+        if (uip_conns[i].tcpstateflags == UIP_CLOSED) break;
+      }
+      if (i == UIP_CONNS) FullTable++;
+
+      for (i = 0; i < n; i++) {
+        // A request still open after a second counts as unanswered
+        Pollers[i].State = P_SYNSENT;
+        Pollers[i].Port = nPort++;
+        Pollers[i].SndNxt = (uint32_t)t * 1000 + i;
+        ClientSend(&Pollers[i], F_SYN, 0, 0);
+        Started++;
+      }
+    }
+    Deliver();
+
+    for (i = 0; i < UIP_CONNS; i++) {
+      uip_rexmit_timer(i);
+      ClientReceive();
+      Deliver();
+    }
+    if (t % 512 == 0) {
+      for (i = 0; i < UIP_CONNS; i++) {
+        uip_periodic(i);
+        ClientReceive();
+        Deliver();
+      }
+    }
+  }
+
+  printf("%u pollers: %u requests, %u answered, %u SYNs dropped, %u resets, table full %u times\n",
+    n, Started, Completed, (unsigned)uip_stat.tcp.syndrop, Resets, FullTable);
+  CHECK(Completed == Started);
+  CHECK(uip_stat.tcp.syndrop == 0);
+  CHECK(Resets == 0);
+#if UIP_TIME_WAIT_SHORT == 0
+  CHECK(FullTable > 0);
+#endif /* UIP_TIME_WAIT_SHORT == 0 */
+}
+
+
+int main(void)
+{
+  uint8_t n;
+
+  for (n = 1; n <= UIP_CONNS; n++) Run(n, 300);
+
+  printf("%u checks, %u failures\n", Checks, Failures);
+  return Failures ? 1 : 0;
+}
@@ -0,0 +1,31 @@
+#!/bin/sh
+# Builds and runs the uIP connection table load test on the host.
+#
+# uip.c is copied with the Cosmic keywords (@far etc.) removed, and in the
+# copy of uipopt.h UIP_BYTE_ORDER is set to little endian and
+# UIP_ASM_CHKSUM to 0 (the STM8 assembly kernel does not build on the
+# host). The other uipopt.h settings are used as they are.
+#
+# Usage: sh tools/tcp_load_test.sh
+
+set -e
+
+top=$(cd "$(dirname "$0")/.." && pwd)
+out=${TMPDIR:-/tmp}/tcp_load_test
+rm -rf "$out"
+mkdir -p "$out"
+
+for f in "$top"/NetworkModule/*.c "$top"/NetworkModule/*.h; do
+  sed -e 's/@far//g; s/@interrupt//g; s/@eeprom//g; s/@tiny//g; s/@near//g' \
+    "$f" > "$out/$(basename "$f")"
+done
+cp "$top"/tools/host/*.h "$out"
+sed -i -e 's/^#define UIP_BYTE_ORDER .*/#define UIP_BYTE_ORDER  UIP_LITTLE_ENDIAN/' \
+  -e 's/^#define UIP_ASM_CHKSUM .*/#define UIP_ASM_CHKSUM  0/' "$out/uipopt.h"
+
+${CC:-cc} -std=c99 -Wall -Wno-unused-function -Wno-pointer-sign \
+  -Wno-missing-braces -Wno-unused-label -I"$out" \
+  -o "$out/tcp_load_test" \
+  "$out/uip.c" "$top/tools/tcp_load_test.c"
+
+"$out/tcp_load_test"